@@ -0,0 +1,66 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BENCH_INCLUDE_BENCH_H
+#define BENCH_INCLUDE_BENCH_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+
+struct bench_suite {
+    const char * name;
+    const char * usage;
+    void (*run)(int argc, char ** argv);
+};
+
+// Monotonic time in nanoseconds
+unsigned long long now_ns();
+
+// Creates a new directory under /tmp holding `count` empty files, and writes its
+// path to `path`. Names are padded to `name_len` characters, which is at least 13.
+void make_flat_tree(char (&path)[PATH_MAX + 1], size_t count, size_t name_len = 13);
+
+// Creates a new directory under /tmp with a chain of `depth` nested directories in
+// it, each holding `files` empty files next to the next directory down. Directory
+// names are `name_len` characters long, so the deepest path is about
+// `depth * (name_len + 1)` characters.
+void make_deep_tree(char (&path)[PATH_MAX + 1], int depth, size_t files, size_t name_len);
+
+// Name of the directory at each level of a tree from `make_deep_tree`
+void deep_tree_dir_name(char * const buf, size_t name_len);
+
+// Deletes a directory created by one of the `make_*_tree` functions
+void remove_tree(const char * const path);
+
+// Sorts `samples`, in milliseconds, and prints their percentiles under `label`
+// along with a rate: `units` divided by the median time, left out if `units` is 0
+void print_percentiles(const char * const label, double * samples, size_t count, double units, const char * const unit_name);
+
+// Prints the column headings for `print_percentiles`
+void print_percentile_header();
+
+void bench_filter(int argc, char ** argv);
+
+void bench_layout(int argc, char ** argv);
+
+void bench_model(int argc, char ** argv);
+
+void bench_sort(int argc, char ** argv);
+
+void bench_stat(int argc, char ** argv);
+
+#endif
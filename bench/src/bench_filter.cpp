@@ -0,0 +1,104 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "../../include/dir_listing.h"
+#include "../../include/name_filter.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const size_t FILTER_BENCH_SIZES[] = { 100000, 1000000 };
+
+// Typed one key at a time, so each prefix is one keystroke
+const char * const FILTER_BENCH_QUERIES[] = { "Rep", "_4", "sum.log" };
+
+static size_t make_name(char * const buf, size_t i) {
+    static const char * const words[] = { "report", "summary", "Build", "trace", "core", "thumb", "index" };
+    static const char * const exts[] = { ".log", ".txt", ".json", ".o", "" };
+    size_t n = i * 2654435761u;
+
+    return snprintf(
+        buf, 64, "%s_%zu_%s%s",
+        words[n % c_arr_size(words)], n % 100000, words[(n / 7) % c_arr_size(words)], exts[(n / 3) % c_arr_size(exts)]
+    );
+}
+
+// The obvious way to do it, for comparison: strcasestr on every name
+static size_t scalar_matches(dir_listing &listing, const char * const query) {
+    size_t count = 0;
+
+    for (size_t row = 0; row < listing.size(); row++) {
+        if (strcasestr(listing.name(listing.at(row)), query)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void bench_query(dir_listing &listing, const char * const query) {
+    name_filter filter;
+    size_t len = strlen(query);
+    double total_ms = 0;
+    double worst_ms = 0;
+
+    for (size_t i = 1; i <= len; i++) {
+        unsigned long long start = now_ns();
+        filter.set_query(listing, query, i);
+        double ms = (now_ns() - start) / 1e6;
+
+        total_ms += ms;
+        worst_ms = ms > worst_ms ? ms : worst_ms;
+    }
+
+    unsigned long long start = now_ns();
+    size_t expected = scalar_matches(listing, query);
+    double scalar_ms = (now_ns() - start) / 1e6;
+
+    if (expected != filter.size()) {
+        printf("Mismatch for \"%s\": %zu matches, expected %zu\n", query, filter.size(), expected);
+    }
+
+    printf(
+        "%10zu %10s %10zu %14.3f %14.3f %14.3f\n",
+        listing.size(), query, filter.size(), worst_ms, total_ms / len, scalar_ms
+    );
+}
+
+// Times the filter one keystroke at a time. The first key of each query scans the
+// whole name pool; the rest narrow down the previous matches.
+void bench_filter(int argc, char ** argv) {
+    char name[64];
+
+    printf("%10s %10s %10s %14s %14s %14s\n", "names", "query", "matches", "worst key (ms)", "mean key (ms)", "strcasestr (ms)");
+
+    for (size_t i = 0; i < c_arr_size(FILTER_BENCH_SIZES); i++) {
+        dir_listing listing;
+
+        for (size_t j = 0; j < FILTER_BENCH_SIZES[i]; j++) {
+            size_t len = make_name(name, j);
+            listing.add(name, len);
+        }
+
+        listing.sort();
+
+        for (size_t j = 0; j < c_arr_size(FILTER_BENCH_QUERIES); j++) {
+            bench_query(listing, FILTER_BENCH_QUERIES[j]);
+        }
+    }
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "../../include/dir_listing.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const size_t LAYOUT_BENCH_ENTRIES = 1000000;
+const int LAYOUT_BENCH_RUNS = 20;
+
+// Rows on one screen of a tall window, for the per-frame loops
+const size_t LAYOUT_BENCH_SCREEN = 80;
+
+// Names in load order have nothing to do with sorted order, like in a real
+// directory, so walking the rows jumps around the entries
+static size_t make_name(char * const buf, size_t i) {
+    static const char * const exts[] = { ".c", ".h", ".o", ".txt", "" };
+    size_t n = (i * 2654435761u) % LAYOUT_BENCH_ENTRIES;
+
+    return snprintf(buf, 64, "%sentry_%07zu%s", n % 10 == 0 ? "." : "", n, exts[n % c_arr_size(exts)]);
+}
+
+// How the window used to decide whether to draw a row as not permitted: from the
+// mode, uid and gid, on every row of every frame
+static bool legacy_has_permission(const path_segment &path, unsigned int uid, unsigned int gid) {
+    if (path.meta != META_DONE) {
+        return true;
+    }
+
+    if (S_ISDIR(path.mode)) {
+        return (S_IXOTH & path.mode) || ((S_IXUSR & path.mode) && uid == path.uid) || ((S_IXGRP & path.mode) && gid == path.gid);
+    }
+
+    return (S_IROTH & path.mode) || ((S_IRUSR & path.mode) && uid == path.uid) || ((S_IRGRP & path.mode) && gid == path.gid);
+}
+
+// What the paint loop needs from each row: whether to shade it and which type to
+// draw. Returns a count so that none of it is optimized out.
+static size_t legacy_rows(dir_listing &listing, size_t first, size_t last, unsigned int uid, unsigned int gid) {
+    size_t count = 0;
+
+    for (size_t row = first; row < last; row++) {
+        const path_segment &path = listing.at(row);
+
+        count += legacy_has_permission(path, uid, gid) + S_ISDIR(path.mode) * 2 + (listing.name(path)[0] == '.') * 4;
+    }
+
+    return count;
+}
+
+static size_t flag_rows(const dir_listing &listing, size_t first, size_t last) {
+    size_t count = 0;
+
+    for (size_t row = first; row < last; row++) {
+        const uint8_t flags = listing.flags_at(row);
+
+        count += !! (flags & ENTRY_PERMITTED) + !! (flags & ENTRY_DIR) * 2 + !! (flags & ENTRY_HIDDEN) * 4;
+    }
+
+    return count;
+}
+
+// Times `legacy` and `flags` over `runs` runs each and prints both. `rows` is how
+// many rows one run goes through.
+template <typename L, typename F>
+static void compare(const char * const label, size_t rows, int runs, L legacy, F flags) {
+    std::vector<double> legacy_ms;
+    std::vector<double> flags_ms;
+    char legacy_label[64];
+    char flags_label[64];
+
+    for (int i = 0; i < runs; i++) {
+        unsigned long long start = now_ns();
+        size_t expected = legacy(i);
+        legacy_ms.push_back((now_ns() - start) / 1e6);
+
+        start = now_ns();
+        size_t actual = flags(i);
+        flags_ms.push_back((now_ns() - start) / 1e6);
+
+        if (actual != expected) {
+            printf("Mismatch in %s: %zu, expected %zu\n", label, actual, expected);
+        }
+    }
+
+    snprintf(legacy_label, sizeof(legacy_label), "%s (mode)", label);
+    snprintf(flags_label, sizeof(flags_label), "%s (flags)", label);
+    print_percentiles(legacy_label, legacy_ms.data(), legacy_ms.size(), rows, "rows");
+    print_percentiles(flags_label, flags_ms.data(), flags_ms.size(), rows, "rows");
+}
+
+// Compares the per-row checks of the paint loop and hit testing done from each
+// entry's mode against the flags that are worked out once when metadata arrives
+void bench_layout(int argc, char ** argv) {
+    const unsigned int uid = getuid();
+    const unsigned int gid = getgid();
+    dir_listing listing;
+    char name[64];
+
+    for (size_t i = 0; i < LAYOUT_BENCH_ENTRIES; i++) {
+        size_t len = make_name(name, i);
+        unsigned int type = i % 3 == 0 ? S_IFDIR : S_IFREG;
+
+        listing.add(name, len, type);
+
+        // A mix of what a shared directory has: some of it ours, some not readable
+        if (i % 4 != 3) {
+            listing.set_meta(i, type | (i % 5 == 0 ? 0700 : 0644), i % 7 == 0 ? uid + 1 : uid, gid);
+        }
+    }
+
+    listing.sort();
+
+    printf("%zu entries, %zu bytes per entry\n", listing.size(), listing.memory_usage() / LAYOUT_BENCH_ENTRIES);
+    print_percentile_header();
+
+    compare(
+        "all rows", LAYOUT_BENCH_ENTRIES, LAYOUT_BENCH_RUNS,
+        [&](int) { return legacy_rows(listing, 0, listing.size(), uid, gid); },
+        [&](int) { return flag_rows(listing, 0, listing.size()); }
+    );
+
+    // One frame scrolled to somewhere else each time, as when dragging through a
+    // huge directory. Each frame misses the cache.
+    const size_t screens = LAYOUT_BENCH_ENTRIES / LAYOUT_BENCH_SCREEN;
+
+    compare(
+        "one screen", LAYOUT_BENCH_SCREEN * screens, LAYOUT_BENCH_RUNS,
+        [&](int) {
+            size_t count = 0;
+
+            for (size_t i = 0; i < screens; i++) {
+                size_t first = ((i * 7919) % screens) * LAYOUT_BENCH_SCREEN;
+                count += legacy_rows(listing, first, first + LAYOUT_BENCH_SCREEN, uid, gid);
+            }
+
+            return count;
+        },
+        [&](int) {
+            size_t count = 0;
+
+            for (size_t i = 0; i < screens; i++) {
+                size_t first = ((i * 7919) % screens) * LAYOUT_BENCH_SCREEN;
+                count += flag_rows(listing, first, first + LAYOUT_BENCH_SCREEN);
+            }
+
+            return count;
+        }
+    );
+}
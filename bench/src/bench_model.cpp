@@ -0,0 +1,210 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../../include/dir_model.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const size_t MODEL_BENCH_SIZES[] = { 1000, 100000, 1000000 };
+// Big directories take long enough to load that a few runs are plenty
+const int MODEL_BENCH_RUNS[] = { 50, 10, 5 };
+
+// Names close to NAME_MAX cost more to read, sort and match
+const size_t MODEL_BENCH_LONG_NAMES = 100000;
+const size_t MODEL_BENCH_LONG_NAME_LEN = 200;
+
+// Deep enough to make paths long, but shallow enough that every level fits in
+// the directory cache
+const int MODEL_BENCH_DEPTH = 24;
+const size_t MODEL_BENCH_DEPTH_FILES = 100;
+const size_t MODEL_BENCH_DEPTH_NAME_LEN = 40;
+const int MODEL_BENCH_NAV_RUNS = 5;
+
+// Typed one key at a time into the filter
+const size_t MODEL_BENCH_QUERY_LEN = 6;
+
+static double ms_since(unsigned long long start) {
+    return (now_ns() - start) / 1e6;
+}
+
+// Feeds the model whatever the loader has until the current directory is loaded.
+// If `first_ms` isn't null, sets it to the time from `start` until the first real
+// entries arrived.
+static void wait_for_load(dir_model &model, unsigned long long start, double * first_ms) {
+    pollfd fds[1];
+    fds[0].fd = model.load_fd();
+    fds[0].events = POLLIN;
+
+    while (! model.is_load_done()) {
+        poll(fds, c_arr_size(fds), -1);
+
+        int retval = model.on_load_progress();
+
+        // "." and ".." come with the first batch, so anything more means real entries
+        if (first_ms && model.listing().size() > 2) {
+            *first_ms = ms_since(start);
+            first_ms = nullptr;
+        }
+
+        if (retval != LOAD_IN_PROGRESS && retval != LOAD_DONE) {
+            printf("Can't read %s: %s\n", model.cwd(), strerror(retval));
+            exit(1);
+        }
+    }
+}
+
+// Loads the directory at `path` from scratch `runs` times, with a new model each
+// time so that nothing is cached, then re-sorts it and types into the filter.
+static void bench_tree(const char * const label, const char * const path, size_t entries, int runs) {
+    const char * const slash = strrchr(path, '/');
+    char parent[PATH_MAX + 1];
+    std::vector<double> load_ms;
+    std::vector<double> first_ms;
+    std::vector<double> sort_ms;
+    std::vector<double> key_ms;
+    char row_label[64];
+
+    snprintf(parent, sizeof(parent), "%.*s", (int) (slash - path), path);
+
+    for (int r = 0; r < runs; r++) {
+        dir_model model(parent, DIR_CACHE_DEFAULT_BUDGET);
+
+        wait_for_load(model, now_ns(), nullptr);
+
+        double first = 0;
+        unsigned long long start = now_ns();
+        model.navigate(slash + 1, strlen(slash + 1));
+        wait_for_load(model, start, &first);
+        load_ms.push_back(ms_since(start));
+        first_ms.push_back(first);
+
+        // Sorting happens a batch at a time during the load; this is what it
+        // costs to sort the whole listing at once
+        const dir_listing &listing = model.listing();
+        dir_listing copy;
+
+        for (size_t i = 0; i < listing.num_entries(); i++) {
+            const path_segment &entry = listing.entry(i);
+            copy.add(listing.name(entry), entry.len);
+        }
+
+        start = now_ns();
+        copy.sort();
+        sort_ms.push_back(ms_since(start));
+
+        // Part of a name from the middle of the listing, after "file_"
+        char query[MODEL_BENCH_QUERY_LEN + 1];
+        memcpy(query, listing.name(listing.entry(listing.index_at(listing.size() / 2))) + 5, MODEL_BENCH_QUERY_LEN);
+
+        for (size_t len = 1; len <= MODEL_BENCH_QUERY_LEN; len++) {
+            start = now_ns();
+            model.set_filter(query, len);
+            key_ms.push_back(ms_since(start));
+        }
+    }
+
+    snprintf(row_label, sizeof(row_label), "load %s", label);
+    print_percentiles(row_label, load_ms.data(), load_ms.size(), entries, "entries");
+    snprintf(row_label, sizeof(row_label), "  first rows");
+    print_percentiles(row_label, first_ms.data(), first_ms.size(), 0, "");
+    snprintf(row_label, sizeof(row_label), "  sort");
+    print_percentiles(row_label, sort_ms.data(), sort_ms.size(), entries, "entries");
+    snprintf(row_label, sizeof(row_label), "  filter key");
+    print_percentiles(row_label, key_ms.data(), key_ms.size(), 1, "keys");
+}
+
+// Goes down a chain of directories and back up. Going down the first time loads
+// every level; going up and down again is served from the directory cache.
+static void bench_navigate() {
+    char path[PATH_MAX + 1];
+    char name[NAME_MAX + 1];
+    std::vector<double> cold_ms;
+    std::vector<double> cached_ms;
+
+    make_deep_tree(path, MODEL_BENCH_DEPTH, MODEL_BENCH_DEPTH_FILES, MODEL_BENCH_DEPTH_NAME_LEN);
+    deep_tree_dir_name(name, MODEL_BENCH_DEPTH_NAME_LEN);
+
+    for (int r = 0; r < MODEL_BENCH_NAV_RUNS; r++) {
+        dir_model model(path, DIR_CACHE_DEFAULT_BUDGET);
+
+        wait_for_load(model, now_ns(), nullptr);
+
+        for (int level = 0; level < MODEL_BENCH_DEPTH; level++) {
+            unsigned long long start = now_ns();
+            model.navigate(name, MODEL_BENCH_DEPTH_NAME_LEN);
+            wait_for_load(model, start, nullptr);
+            cold_ms.push_back(ms_since(start));
+        }
+
+        for (int level = 0; level < MODEL_BENCH_DEPTH; level++) {
+            unsigned long long start = now_ns();
+            model.navigate("..", 2);
+            wait_for_load(model, start, nullptr);
+            cached_ms.push_back(ms_since(start));
+        }
+
+        for (int level = 0; level < MODEL_BENCH_DEPTH; level++) {
+            unsigned long long start = now_ns();
+            model.navigate(name, MODEL_BENCH_DEPTH_NAME_LEN);
+            wait_for_load(model, start, nullptr);
+            cached_ms.push_back(ms_since(start));
+        }
+    }
+
+    print_percentiles("navigate (not cached)", cold_ms.data(), cold_ms.size(), 1, "dirs");
+    print_percentiles("navigate (cached)", cached_ms.data(), cached_ms.size(), 1, "dirs");
+
+    remove_tree(path);
+}
+
+// Drives the directory model the way the window does, on generated trees, and
+// reports latency percentiles for loading, sorting, filtering and navigating.
+// Trees go under /tmp, so this measures whatever filesystem that is.
+void bench_model(int argc, char ** argv) {
+    size_t max_entries = argc > 0 ? strtoull(argv[0], nullptr, 10) : SIZE_MAX;
+    char path[PATH_MAX + 1];
+    char label[64];
+
+    print_percentile_header();
+
+    for (size_t i = 0; i < c_arr_size(MODEL_BENCH_SIZES); i++) {
+        const size_t entries = MODEL_BENCH_SIZES[i];
+
+        if (entries > max_entries) {
+            continue;
+        }
+
+        make_flat_tree(path, entries);
+        snprintf(label, sizeof(label), "%zu", entries);
+        bench_tree(label, path, entries, MODEL_BENCH_RUNS[i]);
+        remove_tree(path);
+    }
+
+    if (MODEL_BENCH_LONG_NAMES <= max_entries) {
+        make_flat_tree(path, MODEL_BENCH_LONG_NAMES, MODEL_BENCH_LONG_NAME_LEN);
+        snprintf(label, sizeof(label), "%zu long names", MODEL_BENCH_LONG_NAMES);
+        bench_tree(label, path, MODEL_BENCH_LONG_NAMES, MODEL_BENCH_RUNS[1]);
+        remove_tree(path);
+    }
+
+    bench_navigate();
+}
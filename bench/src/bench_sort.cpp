@@ -0,0 +1,151 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/dir_listing.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const size_t SORT_BENCH_SIZES[] = { 1000, 100000, 1000000 };
+// The old quicksort goes quadratic on sorted input, so don't wait for it past this
+const size_t LEGACY_SORTED_MAX = 20000;
+
+// The listing layout and sort that fx used before: fixed-size entries with the
+// name inline, sorted in place by a first-element-pivot quicksort
+struct legacy_segment {
+    char name[256];
+    size_t len;
+    int y_bot;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+};
+
+static int legacy_str_cmp(const char * const a, size_t a_len, const char * const b, size_t b_len) {
+    size_t len = a_len <= b_len ? a_len : b_len;
+
+    for (size_t i = 0; i < len; i++) {
+        char a_char = a[i];
+        char b_char = b[i];
+
+        if (a_char < b_char) {
+            return -1;
+        } else if (a_char > b_char) {
+            return 1;
+        }
+    }
+
+    if (a_len < b_len) {
+        return -1;
+    } else if (a_len > b_len) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int legacy_partition(legacy_segment * a, int lo, int hi) {
+    legacy_segment pivot = a[lo];
+
+    int i = lo - 1;
+    int j = hi + 1;
+
+    while (1) {
+        do {
+            i++;
+        } while (legacy_str_cmp(a[i].name, a[i].len, pivot.name, pivot.len) < 0);
+
+        do {
+            j--;
+        } while (legacy_str_cmp(a[j].name, a[j].len, pivot.name, pivot.len) > 0);
+
+        if (i >= j) {
+            return j;
+        }
+
+        legacy_segment tmp = a[i];
+        a[i] = a[j];
+        a[j] = tmp;
+    }
+}
+
+static void legacy_quicksort(legacy_segment * a, int lo, int hi) {
+    if (lo >= 0 && hi >= 0 && lo < hi) {
+        int p = legacy_partition(a, lo, hi);
+
+        legacy_quicksort(a, lo, p);
+        legacy_quicksort(a, p + 1, hi);
+    }
+}
+
+// Names shaped like the ones in our build output directories: a shared prefix,
+// a number, and an extension
+static size_t make_name(char * const buf, size_t i, size_t count, bool sorted) {
+    static const char * const exts[] = { ".o", ".d", ".log", ".json", "" };
+    size_t n = sorted ? i : (i * 2654435761u) % count;
+
+    return snprintf(buf, 64, "artifact_%09zu%s", n, exts[n % c_arr_size(exts)]);
+}
+
+static void bench_one(size_t count, bool sorted) {
+    char name[64];
+    dir_listing listing;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t len = make_name(name, i, count, sorted);
+        listing.add(name, len);
+    }
+
+    unsigned long long start = now_ns();
+    listing.sort();
+    double new_ms = (now_ns() - start) / 1e6;
+
+    printf("%10zu %8s %14.2f", count, sorted ? "sorted" : "shuffled", new_ms);
+
+    if (sorted && count > LEGACY_SORTED_MAX) {
+        printf(" %14s\n", "(quadratic)");
+        return;
+    }
+
+    legacy_segment * legacy = (legacy_segment *) malloc(count * sizeof(legacy_segment));
+    check_error(legacy, (legacy_segment *) nullptr);
+
+    for (size_t i = 0; i < count; i++) {
+        legacy[i].len = make_name(legacy[i].name, i, count, sorted);
+    }
+
+    start = now_ns();
+    legacy_quicksort(legacy, 0, count - 1);
+    double legacy_ms = (now_ns() - start) / 1e6;
+
+    printf(" %14.2f %9.1fx\n", legacy_ms, legacy_ms / new_ms);
+
+    free(legacy);
+}
+
+// Compares the listing's sort with the quicksort it replaced, on shuffled and
+// already sorted input
+void bench_sort(int argc, char ** argv) {
+    printf("%10s %8s %14s %14s %10s\n", "names", "input", "introsort (ms)", "legacy (ms)", "speedup");
+
+    for (size_t i = 0; i < c_arr_size(SORT_BENCH_SIZES); i++) {
+        bench_one(SORT_BENCH_SIZES[i], false);
+        bench_one(SORT_BENCH_SIZES[i], true);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include "../../include/dir_listing.h"
+#include "../../include/dir_reader.h"
+#include "../../include/stat_pool.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const size_t STAT_BENCH_FILES = 100000;
+const unsigned int STAT_BENCH_THREADS[] = { 0, 1, 2, 4, 8, 16, 32 };
+const int STAT_BENCH_RUNS = 5;
+
+// Times a full stat pass over a directory for different pool sizes. On a local
+// disk the whole directory sits in the dentry cache and extra threads barely help;
+// the interesting numbers come from pointing this at an NFS or FUSE mount.
+void bench_stat(int argc, char ** argv) {
+    char path[PATH_MAX + 1];
+    bool generated = argc < 1;
+
+    if (generated) {
+        make_flat_tree(path, STAT_BENCH_FILES);
+    } else {
+        snprintf(path, sizeof(path), "%s", argv[0]);
+    }
+
+    dir_listing listing;
+    dir_reader reader;
+
+    reader.open(path);
+
+    while (reader.read_batch(listing));
+
+    printf("%zu entries in %s\n", listing.size(), path);
+    printf("%8s %12s %12s %10s\n", "threads", "best (ms)", "median (ms)", "speedup");
+
+    double base_ms = 0;
+
+    for (size_t t = 0; t < c_arr_size(STAT_BENCH_THREADS); t++) {
+        stat_pool pool(STAT_BENCH_THREADS[t]);
+        double runs[STAT_BENCH_RUNS];
+
+        for (int r = 0; r < STAT_BENCH_RUNS; r++) {
+            unsigned long long start = now_ns();
+            pool.stat_range(reader, listing, 0, listing.size());
+            runs[r] = (now_ns() - start) / 1e6;
+        }
+
+        // Insertion sort, there are only a handful of runs
+        for (int i = 1; i < STAT_BENCH_RUNS; i++) {
+            for (int j = i; j > 0 && runs[j - 1] > runs[j]; j--) {
+                double tmp = runs[j];
+                runs[j] = runs[j - 1];
+                runs[j - 1] = tmp;
+            }
+        }
+
+        if (t == 0) {
+            base_ms = runs[STAT_BENCH_RUNS / 2];
+        }
+
+        printf("%8u %12.2f %12.2f %9.2fx\n", STAT_BENCH_THREADS[t], runs[0], runs[STAT_BENCH_RUNS / 2], base_ms / runs[STAT_BENCH_RUNS / 2]);
+    }
+
+    reader.close();
+
+    if (generated) {
+        remove_tree(path);
+    }
+}
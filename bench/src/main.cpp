@@ -0,0 +1,157 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../include/dir_listing.h"
+#include "../../include/dir_reader.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+const bench_suite SUITES[] = {
+    { "filter", "", bench_filter },
+    { "layout", "", bench_layout },
+    { "model", "[max entries]", bench_model },
+    { "sort", "", bench_sort },
+    { "stat", "[dir]", bench_stat },
+};
+
+// Creates `count` empty files in `dir_fd`, with names padded to `name_len`
+static void make_files(int dir_fd, size_t count, size_t name_len) {
+    char name[NAME_MAX + 1];
+
+    if (name_len > NAME_MAX) {
+        name_len = NAME_MAX;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int len = snprintf(name, sizeof(name), "file_%08zx", (i * 2654435761u) % (count * 4));
+
+        memset(name + len, '_', name_len > (size_t) len ? name_len - len : 0);
+        name[name_len > (size_t) len ? name_len : len] = '\0';
+
+        int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        check_error(fd, -1);
+        close(fd);
+    }
+}
+
+void make_flat_tree(char (&path)[PATH_MAX + 1], size_t count, size_t name_len) {
+    strcpy(path, "/tmp/fx_bench_XXXXXX");
+    char * retval = mkdtemp(path);
+    check_error(retval, (char *) nullptr);
+
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    check_error(dir_fd, -1);
+
+    make_files(dir_fd, count, name_len);
+    close(dir_fd);
+}
+
+void deep_tree_dir_name(char * const buf, size_t name_len) {
+    memset(buf, 'd', name_len);
+    buf[name_len] = '\0';
+}
+
+void make_deep_tree(char (&path)[PATH_MAX + 1], int depth, size_t files, size_t name_len) {
+    char name[NAME_MAX + 1];
+
+    strcpy(path, "/tmp/fx_bench_XXXXXX");
+    char * retval = mkdtemp(path);
+    check_error(retval, (char *) nullptr);
+    deep_tree_dir_name(name, name_len);
+
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    check_error(dir_fd, -1);
+
+    for (int level = 0; level < depth; level++) {
+        make_files(dir_fd, files, 13);
+
+        int retval = mkdirat(dir_fd, name, 0755);
+        check_error(retval, -1);
+
+        int next_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        check_error(next_fd, -1);
+        close(dir_fd);
+        dir_fd = next_fd;
+    }
+
+    close(dir_fd);
+}
+
+void remove_tree(const char * const path) {
+    dir_listing listing;
+    dir_reader reader;
+    char child[PATH_MAX + 1];
+
+    reader.open(path);
+
+    while (reader.read_batch(listing));
+
+    reader.close();
+
+    for (size_t i = 0; i < listing.num_entries(); i++) {
+        const path_segment &entry = listing.entry(i);
+        const char * const name = listing.name(entry);
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, name);
+
+        if (S_ISDIR(entry.mode)) {
+            remove_tree(child);
+        } else {
+            unlink(child);
+        }
+    }
+
+    rmdir(path);
+}
+
+int main(int argc, char ** argv) {
+    const char * const suite = argc > 1 ? argv[1] : nullptr;
+    bool found = false;
+
+    for (size_t i = 0; i < c_arr_size(SUITES); i++) {
+        if (suite && strcmp(suite, SUITES[i].name) != 0) {
+            continue;
+        }
+
+        printf("== %s ==\n", SUITES[i].name);
+        SUITES[i].run(suite ? argc - 2 : 0, argv + 2);
+        printf("\n");
+        found = true;
+    }
+
+    if (! found) {
+        printf("Usage: %s [suite] [args]\nSuites:\n", argv[0]);
+
+        for (size_t i = 0; i < c_arr_size(SUITES); i++) {
+            printf("    %s %s\n", SUITES[i].name, SUITES[i].usage);
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,735 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// Plays a trace recorded with FX_TRACE back to fx running on Xvfb. fx talks to
+// Xvfb through a proxy here, which counts the bytes each way and watches fx's
+// requests for the ones that put the back buffer on the window - a CopyArea, or
+// a PutImage or ShmPutImage with FX_RENDER=client - so each one is a paint.
+// Events are sent with XSendEvent in the recorded order. Each one waits for the
+// paint it causes, or for a timeout, before the next is sent, so every paint can
+// be charged to one event.
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <X11/keysym.h>
+#include <X11/Xlib.h>
+#include <X11/Xproto.h>
+#include <X11/extensions/shmproto.h>
+#include "../../include/event_trace.h"
+#include "../../include/util.h"
+#include "../include/bench.h"
+
+// Xvfb runs on the first free display from this one on, and the proxy pretends to
+// be the next one. Both have to be free.
+const int REPLAY_DISPLAY = 99;
+const int REPLAY_DISPLAY_TRIES = 100;
+
+// How long Xvfb and fx get to start up
+const int STARTUP_TIMEOUT_MS = 5000;
+
+// fx has to be this quiet after its first frame before the replay starts, so that
+// the initial load isn't charged to the first event
+const int SETTLE_MS = 500;
+
+// An event that hasn't caused a paint after this long is counted as not causing one
+const int PAINT_TIMEOUT_MS = 250;
+
+// How long fx gets to quit at the end
+const int EXIT_TIMEOUT_MS = 2000;
+
+const size_t PROXY_BUFFER_SIZE = 64 * 1024;
+
+// Forwards one client connection to the X server and keeps tabs on what the
+// client asks for
+class x_proxy {
+    public:
+        uint64_t bytes_to_server;
+        uint64_t bytes_to_client;
+        uint64_t requests;
+        // Reads from the client that had at least one paint in them. fx flushes
+        // once per frame, so this is close to the number of frames.
+        uint64_t frames;
+        unsigned long long last_paint_ns;
+        unsigned long long last_request_ns;
+        // fx's window, once it has created one
+        uint32_t window;
+        bool mapped;
+        // Major opcode of MIT-SHM on the server, or 0
+        int shm_opcode;
+
+        x_proxy(int client_fd, int server_fd);
+
+        // Forwards whatever arrives within `timeout_ms`. Returns false once the
+        // client has disconnected.
+        bool pump(int timeout_ms);
+
+    private:
+        int client_fd;
+        int server_fd;
+        bool connected;
+        // The client's request stream is read as it goes past: the first bytes of
+        // each request are gathered in `head`, and the rest is skipped
+        bool setup_done;
+        bool big_endian;
+        unsigned char head[16];
+        size_t head_len;
+        size_t head_want;
+        uint64_t skip;
+
+        bool forward(int from, int to, bool from_client);
+        bool scan(const unsigned char * buf, size_t len);
+        bool on_head();
+        uint32_t read16(size_t pos) const;
+        uint32_t read32(size_t pos) const;
+};
+
+x_proxy::x_proxy(int client_fd, int server_fd) {
+    this->client_fd = client_fd;
+    this->server_fd = server_fd;
+    this->connected = true;
+    this->bytes_to_server = 0;
+    this->bytes_to_client = 0;
+    this->requests = 0;
+    this->frames = 0;
+    this->last_paint_ns = 0;
+    this->last_request_ns = 0;
+    this->window = 0;
+    this->mapped = false;
+    this->shm_opcode = 0;
+    this->setup_done = false;
+    this->big_endian = false;
+    this->head_len = 0;
+    // Fixed part of the connection setup
+    this->head_want = 12;
+    this->skip = 0;
+}
+
+bool x_proxy::pump(int timeout_ms) {
+    if (! this->connected) {
+        return false;
+    }
+
+    pollfd fds[2];
+    fds[0].fd = this->client_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = this->server_fd;
+    fds[1].events = POLLIN;
+
+    int retval = poll(fds, c_arr_size(fds), timeout_ms);
+
+    if (retval == -1 && errno == EINTR) {
+        return true;
+    }
+
+    check_error(retval, -1);
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        this->connected = this->forward(this->client_fd, this->server_fd, true);
+    }
+
+    if (this->connected && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        this->connected = this->forward(this->server_fd, this->client_fd, false);
+    }
+
+    return this->connected;
+}
+
+bool x_proxy::forward(int from, int to, bool from_client) {
+    unsigned char buf[PROXY_BUFFER_SIZE];
+    ssize_t len = read(from, buf, sizeof(buf));
+
+    if (len <= 0) {
+        return false;
+    }
+
+    if (from_client) {
+        this->bytes_to_server += len;
+        this->last_request_ns = now_ns();
+
+        if (this->scan(buf, len)) {
+            this->frames++;
+            this->last_paint_ns = this->last_request_ns;
+        }
+    } else {
+        this->bytes_to_client += len;
+    }
+
+    for (ssize_t written = 0; written < len; ) {
+        // fx going away mid-write shouldn't take the harness with it
+        ssize_t retval = send(to, buf + written, len - written, MSG_NOSIGNAL);
+
+        if (retval <= 0) {
+            return false;
+        }
+
+        written += retval;
+    }
+
+    return true;
+}
+
+// Returns true if any of the requests in `buf` paints the window
+bool x_proxy::scan(const unsigned char * buf, size_t len) {
+    bool painted = false;
+    size_t pos = 0;
+
+    while (pos < len) {
+        if (this->skip != 0) {
+            size_t n = this->skip < len - pos ? this->skip : len - pos;
+
+            this->skip -= n;
+            pos += n;
+            continue;
+        }
+
+        size_t n = this->head_want - this->head_len;
+
+        if (n > len - pos) {
+            n = len - pos;
+        }
+
+        memcpy(this->head + this->head_len, buf + pos, n);
+        this->head_len += n;
+        pos += n;
+
+        if (this->head_len == this->head_want) {
+            painted |= this->on_head();
+        }
+    }
+
+    return painted;
+}
+
+// Called when `head_want` bytes of a request have been gathered. Either asks for
+// more or looks at the request and skips the rest of it.
+bool x_proxy::on_head() {
+    if (! this->setup_done) {
+        this->big_endian = this->head[0] == 'B';
+
+        const uint32_t name_len = this->read16(6);
+        const uint32_t data_len = this->read16(8);
+
+        this->skip = ((name_len + 3) & ~3u) + ((data_len + 3) & ~3u);
+        this->setup_done = true;
+        this->head_len = 0;
+        this->head_want = 4;
+
+        return false;
+    }
+
+    uint64_t total = this->read16(2) * 4ull;
+    // With BIG-REQUESTS a length of 0 means the real length follows, which moves
+    // everything after it along
+    size_t offset = 0;
+
+    if (total == 0) {
+        if (this->head_len < 8) {
+            this->head_want = 8;
+
+            return false;
+        }
+
+        total = this->read32(4) * 4ull;
+        offset = 4;
+    }
+
+    if (total < this->head_len) {
+        total = this->head_len;
+    }
+
+    // Enough to see the two ids after the length
+    const size_t want = total < 12 + offset ? total : 12 + offset;
+
+    if (this->head_len < want) {
+        this->head_want = want;
+
+        return false;
+    }
+
+    bool painted = false;
+
+    if (this->head_len >= 12 + offset) {
+        const uint32_t first = this->read32(4 + offset);
+        const uint32_t second = this->read32(8 + offset);
+
+        switch (this->head[0]) {
+            case X_CreateWindow:
+                // fx's only window is the first it creates
+                if (this->window == 0) {
+                    this->window = first;
+                }
+                break;
+            case X_CopyArea:
+                painted = this->window != 0 && second == this->window;
+                break;
+            case X_PutImage:
+                painted = this->window != 0 && first == this->window;
+                break;
+        }
+
+        if (this->shm_opcode != 0 && this->head[0] == this->shm_opcode && this->head[1] == X_ShmPutImage) {
+            painted = this->window != 0 && first == this->window;
+        }
+    }
+
+    if (this->head[0] == X_MapWindow && this->head_len >= 8 + offset && this->read32(4 + offset) == this->window) {
+        this->mapped = true;
+    }
+
+    this->requests++;
+    this->skip = total - this->head_len;
+    this->head_len = 0;
+    this->head_want = 4;
+
+    return painted;
+}
+
+uint32_t x_proxy::read16(size_t pos) const {
+    if (this->big_endian) {
+        return (this->head[pos] << 8) | this->head[pos + 1];
+    }
+
+    return this->head[pos] | (this->head[pos + 1] << 8);
+}
+
+uint32_t x_proxy::read32(size_t pos) const {
+    if (this->big_endian) {
+        return (this->read16(pos) << 16) | this->read16(pos + 2);
+    }
+
+    return this->read16(pos) | (this->read16(pos + 2) << 16);
+}
+
+static void socket_path(sockaddr_un &addr, int display) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/.X11-unix/X%d", display);
+}
+
+// True if no X server has `display`. A socket that nothing is listening on is left
+// over from a server that's gone, so it's removed; anything else is left alone.
+static bool display_free(int display) {
+    char lock_path[32];
+    snprintf(lock_path, sizeof(lock_path), "/tmp/.X%d-lock", display);
+
+    if (access(lock_path, F_OK) == 0) {
+        return false;
+    }
+
+    sockaddr_un addr;
+    socket_path(addr, display);
+
+    if (access(addr.sun_path, F_OK) != 0) {
+        return true;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check_error(fd, -1);
+
+    const bool refused = connect(fd, (sockaddr *) &addr, sizeof(addr)) == -1 && errno == ECONNREFUSED;
+    close(fd);
+
+    return refused && unlink(addr.sun_path) == 0;
+}
+
+// Returns the first display from REPLAY_DISPLAY on that's free along with the next
+// one, or -1 if there isn't one
+static int find_displays() {
+    for (int display = REPLAY_DISPLAY; display < REPLAY_DISPLAY + REPLAY_DISPLAY_TRIES; display++) {
+        if (display_free(display) && display_free(display + 1)) {
+            return display;
+        }
+    }
+
+    return -1;
+}
+
+// Starts `argv` with DISPLAY set to `display`, or left alone if it's negative
+static pid_t spawn(const char * const * argv, int display) {
+    pid_t pid = fork();
+    check_error(pid, -1);
+
+    if (pid == 0) {
+        if (display >= 0) {
+            char name[16];
+
+            snprintf(name, sizeof(name), ":%d", display);
+            setenv("DISPLAY", name, 1);
+        }
+
+        execvp(argv[0], (char * const *) argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+// True if `pid` has exited, which for the children here means they couldn't start
+static bool has_exited(pid_t pid) {
+    return waitpid(pid, nullptr, WNOHANG) == pid;
+}
+
+// Stops a child, unless it has stopped on its own
+static void stop_child(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Connects to the X server on `display`, retrying until it has started up.
+// Returns -1 if `server` exits or doesn't start listening in time.
+static int connect_display(int display, pid_t server) {
+    sockaddr_un addr;
+    socket_path(addr, display);
+
+    for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 10) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        check_error(fd, -1);
+
+        if (connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+
+        close(fd);
+
+        if (has_exited(server)) {
+            fprintf(stderr, "The X server for :%d exited; is Xvfb installed?\n", display);
+
+            return -1;
+        }
+
+        usleep(10 * 1000);
+    }
+
+    fprintf(stderr, "Timed out waiting for the X server on :%d\n", display);
+
+    return -1;
+}
+
+// Pretends to be the X server on `display`, which has to be free
+static int listen_display(int display) {
+    sockaddr_un addr;
+    socket_path(addr, display);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check_error(fd, -1);
+    check_error(bind(fd, (sockaddr *) &addr, sizeof(addr)), -1);
+    check_error(listen(fd, 1), -1);
+
+    return fd;
+}
+
+// Waits for `client` to connect. Returns -1 if it exits or doesn't connect in time.
+static int accept_client(int listen_fd, pid_t client) {
+    pollfd pfd;
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+
+    for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 10) {
+        if (poll(&pfd, 1, 10) == 1) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            check_error(fd, -1);
+
+            return fd;
+        }
+
+        if (has_exited(client)) {
+            fprintf(stderr, "fx exited before connecting\n");
+
+            return -1;
+        }
+    }
+
+    fprintf(stderr, "Timed out waiting for fx to connect\n");
+
+    return -1;
+}
+
+// Sends a recorded event to fx's window as if it came from the server
+static void send_event(Display * dis, Window win, const trace_event &rec) {
+    XEvent event;
+    long mask;
+
+    memset(&event, 0, sizeof(event));
+    event.type = rec.type;
+
+    switch (rec.type) {
+        case ButtonPress:
+            event.xbutton.window = win;
+            event.xbutton.root = DefaultRootWindow(dis);
+            event.xbutton.time = CurrentTime;
+            event.xbutton.x = rec.x;
+            event.xbutton.y = rec.y;
+            event.xbutton.state = rec.state;
+            event.xbutton.button = rec.detail;
+            event.xbutton.same_screen = True;
+            mask = ButtonPressMask;
+            break;
+        case KeyPress:
+            event.xkey.window = win;
+            event.xkey.root = DefaultRootWindow(dis);
+            event.xkey.time = CurrentTime;
+            event.xkey.x = rec.x;
+            event.xkey.y = rec.y;
+            event.xkey.state = rec.state;
+            event.xkey.keycode = XKeysymToKeycode(dis, rec.detail);
+            event.xkey.same_screen = True;
+            mask = KeyPressMask;
+            break;
+        case MotionNotify:
+            event.xmotion.window = win;
+            event.xmotion.root = DefaultRootWindow(dis);
+            event.xmotion.time = CurrentTime;
+            event.xmotion.x = rec.x;
+            event.xmotion.y = rec.y;
+            event.xmotion.state = rec.state;
+            event.xmotion.same_screen = True;
+            mask = PointerMotionMask;
+            break;
+        default:
+            return;
+    }
+
+    XSendEvent(dis, win, False, mask, &event);
+    XFlush(dis);
+}
+
+static void send_key(Display * dis, Window win, KeySym key) {
+    trace_event rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = KeyPress;
+    rec.detail = key;
+    send_event(dis, win, rec);
+}
+
+// Latencies for one kind of event
+struct latency_set {
+    const char * label;
+    uint32_t type;
+    std::vector<double> samples;
+    size_t unpainted;
+};
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        printf("Usage: %s trace [fx binary]\n", argv[0]);
+        printf("Replays a trace recorded with FX_TRACE. Run it from the directory the trace was recorded in.\n");
+
+        return 1;
+    }
+
+    std::vector<trace_event> events;
+
+    if (! read_trace(argv[1], events)) {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+
+        return 1;
+    }
+
+    const int display = find_displays();
+
+    if (display == -1) {
+        fprintf(stderr, "No free pair of displays from :%d to :%d\n", REPLAY_DISPLAY, REPLAY_DISPLAY + REPLAY_DISPLAY_TRIES);
+
+        return 1;
+    }
+
+    char display_name[16];
+    char proxy_display_name[16];
+    snprintf(display_name, sizeof(display_name), ":%d", display);
+    snprintf(proxy_display_name, sizeof(proxy_display_name), ":%d", display + 1);
+
+    const char * const xvfb_argv[] = { "Xvfb", display_name, "-screen", "0", "1280x1024x24", "-nolisten", "tcp", nullptr };
+    const char * const fx_argv[] = { argc > 2 ? argv[2] : "./fx_bin", nullptr };
+
+    pid_t xvfb = spawn(xvfb_argv, -1);
+    int server_fd = connect_display(display, xvfb);
+
+    if (server_fd == -1) {
+        stop_child(xvfb);
+
+        return 1;
+    }
+
+    sockaddr_un proxy_addr;
+    socket_path(proxy_addr, display + 1);
+
+    int listen_fd = listen_display(display + 1);
+    pid_t fx = spawn(fx_argv, display + 1);
+    int client_fd = accept_client(listen_fd, fx);
+    // Xvfb has to be stopped if anything fails from here on, or it keeps the display
+    Display * dis = client_fd == -1 ? nullptr : XOpenDisplay(display_name);
+
+    if (! dis) {
+        if (client_fd != -1) {
+            fprintf(stderr, "Can't open %s\n", display_name);
+        }
+
+        stop_child(fx);
+        stop_child(xvfb);
+        unlink(proxy_addr.sun_path);
+
+        return 1;
+    }
+
+    x_proxy proxy(client_fd, server_fd);
+
+    // Extension opcodes are the same for every client of a server
+    int first_event;
+    int first_error;
+
+    XQueryExtension(dis, "MIT-SHM", &proxy.shm_opcode, &first_event, &first_error);
+
+    // Wait for the first frame, then for fx to finish loading
+    const unsigned long long startup = now_ns();
+    bool running = true;
+
+    while (running && proxy.frames == 0 && now_ns() - startup < STARTUP_TIMEOUT_MS * 1000000ull) {
+        running = proxy.pump(10);
+    }
+
+    while (running && now_ns() - proxy.last_request_ns < SETTLE_MS * 1000000ull) {
+        running = proxy.pump(10);
+    }
+
+    if (! proxy.mapped || proxy.frames == 0) {
+        fprintf(stderr, "fx didn't draw its window\n");
+        running = false;
+    }
+
+    const uint64_t startup_frames = proxy.frames;
+    const uint64_t startup_to_server = proxy.bytes_to_server;
+    const uint64_t startup_to_client = proxy.bytes_to_client;
+    const uint64_t startup_requests = proxy.requests;
+
+    latency_set sets[] = {
+        { "key press", KeyPress, {}, 0 },
+        { "button press", ButtonPress, {}, 0 },
+        { "motion", MotionNotify, {}, 0 },
+    };
+    std::vector<double> all;
+    size_t replayed = 0;
+    unsigned long long last_sent = 0;
+    const unsigned long long replay_start = now_ns();
+
+    for (size_t i = 0; running && i < events.size(); i++) {
+        latency_set * set = nullptr;
+
+        for (size_t j = 0; j < c_arr_size(sets); j++) {
+            if (sets[j].type == events[i].type) {
+                set = &sets[j];
+            }
+        }
+
+        // The server sends its own expose events
+        if (! set) {
+            continue;
+        }
+
+        // Keep the recorded gaps, except where the last event took longer to paint
+        if (last_sent != 0 && i > 0) {
+            const unsigned long long due = last_sent + (events[i].time_ns - events[i - 1].time_ns);
+
+            while (running && now_ns() < due) {
+                running = proxy.pump((due - now_ns()) / 1000000 + 1);
+            }
+        }
+
+        const uint64_t frames = proxy.frames;
+
+        last_sent = now_ns();
+        send_event(dis, proxy.window, events[i]);
+        replayed++;
+
+        while (running && proxy.frames == frames && now_ns() - last_sent < PAINT_TIMEOUT_MS * 1000000ull) {
+            running = proxy.pump(1);
+        }
+
+        if (proxy.frames != frames) {
+            const double ms = (proxy.last_paint_ns - last_sent) / 1e6;
+
+            set->samples.push_back(ms);
+            all.push_back(ms);
+        } else {
+            set->unpainted++;
+        }
+    }
+
+    const double replay_ms = (now_ns() - replay_start) / 1e6;
+    const uint64_t frames = proxy.frames - startup_frames;
+    const uint64_t to_server = proxy.bytes_to_server - startup_to_server;
+    const uint64_t to_client = proxy.bytes_to_client - startup_to_client;
+    const uint64_t requests = proxy.requests - startup_requests;
+
+    printf("== replay ==\n");
+    printf("%zu of %zu recorded events replayed in %.0f ms\n\n", replayed, events.size(), replay_ms);
+    printf("Event to paint:\n");
+    print_percentile_header();
+
+    for (size_t i = 0; i < c_arr_size(sets); i++) {
+        print_percentiles(sets[i].label, sets[i].samples.data(), sets[i].samples.size(), 0, "");
+    }
+
+    print_percentiles("all", all.data(), all.size(), 0, "");
+
+    for (size_t i = 0; i < c_arr_size(sets); i++) {
+        if (sets[i].unpainted != 0) {
+            printf("%-28s %zu didn't paint within %d ms\n", sets[i].label, sets[i].unpainted, PAINT_TIMEOUT_MS);
+        }
+    }
+
+    printf("\n%-28s %12s %12s\n", "", "startup", "replay");
+    printf("%-28s %12llu %12llu\n", "frames", (unsigned long long) startup_frames, (unsigned long long) frames);
+    printf("%-28s %12llu %12llu\n", "requests", (unsigned long long) startup_requests, (unsigned long long) requests);
+    printf("%-28s %12llu %12llu\n", "bytes to server", (unsigned long long) startup_to_server, (unsigned long long) to_server);
+    printf("%-28s %12llu %12llu\n", "bytes from server", (unsigned long long) startup_to_client, (unsigned long long) to_client);
+
+    if (frames != 0) {
+        printf("%-28s %12s %12llu\n", "bytes to server per frame", "", (unsigned long long) (to_server / frames));
+    }
+
+    // Let fx quit on its own so it can write FX_PERF_LOG, unless the trace already
+    // made it quit. Escape first in case a prompt is open.
+    if (running) {
+        send_key(dis, proxy.window, XK_Escape);
+        send_key(dis, proxy.window, 'q');
+
+        const unsigned long long quit = now_ns();
+
+        while (proxy.pump(10) && now_ns() - quit < EXIT_TIMEOUT_MS * 1000000ull);
+    }
+
+    stop_child(fx);
+    XCloseDisplay(dis);
+    stop_child(xvfb);
+    unlink(proxy_addr.sun_path);
+    close(listen_fd);
+    close(client_fd);
+    close(server_fd);
+
+    return 0;
+}
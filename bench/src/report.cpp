@@ -0,0 +1,67 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/bench.h"
+
+unsigned long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void print_percentile_header() {
+    printf("%-28s %9s %9s %9s %9s %16s\n", "", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)", "rate");
+}
+
+static int compare_doubles(const void * a, const void * b) {
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+void print_percentiles(const char * const label, double * samples, size_t count, double units, const char * const unit_name) {
+    if (count == 0) {
+        return;
+    }
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    // Nearest rank
+    const double p50 = samples[(count - 1) * 50 / 100];
+    const double p90 = samples[(count - 1) * 90 / 100];
+    const double p99 = samples[(count - 1) * 99 / 100];
+    const double rate = p50 > 0 ? units / (p50 / 1000) : 0;
+    char rate_str[32];
+
+    if (units == 0) {
+        snprintf(rate_str, sizeof(rate_str), "-");
+    } else if (rate >= 1e6) {
+        snprintf(rate_str, sizeof(rate_str), "%.1fM %s/s", rate / 1e6, unit_name);
+    } else if (rate >= 1e3) {
+        snprintf(rate_str, sizeof(rate_str), "%.1fk %s/s", rate / 1e3, unit_name);
+    } else {
+        snprintf(rate_str, sizeof(rate_str), "%.1f %s/s", rate, unit_name);
+    }
+
+    printf("%-28s %9.3f %9.3f %9.3f %9.3f %16s\n", label, p50, p90, p99, samples[count - 1], rate_str);
+}
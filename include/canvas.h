@@ -0,0 +1,199 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_CANVAS_H
+#define INCLUDE_CANVAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+
+// Most rectangles a client side canvas keeps between two flushes before it
+// presents their union instead
+const size_t MAX_PRESENTS = 16;
+
+// The back buffer that the window is drawn into and copied from. There are two:
+// one keeps the buffer in a pixmap and draws with core X requests, and one draws
+// into an image on this side and sends it whole. Set FX_RENDER=client to use the
+// second.
+//
+// Coordinates and colors are the same as Xlib's. Text is drawn in the GC's font.
+class canvas {
+    public:
+        virtual ~canvas();
+
+        // Makes the buffer at least `width` by `height`. What's in it is lost.
+        virtual void resize(int width, int height) = 0;
+
+        // Called before anything is drawn in a frame
+        virtual void begin();
+
+        virtual void set_color(unsigned long pixel) = 0;
+
+        virtual void fill_rect(int x, int y, int width, int height) = 0;
+
+        // Outlines a rectangle like XDrawRectangle: the outline covers `width + 1`
+        // by `height + 1` pixels
+        virtual void draw_rect(int x, int y, int width, int height) = 0;
+
+        // Draws a horizontal line from `x1` to `x2`, inclusive
+        virtual void draw_hline(int x1, int x2, int y) = 0;
+
+        virtual void draw_string(int x, int baseline, const char * const str, size_t len) = 0;
+
+        // Nothing outside the band [top, bottom) is drawn until `clear_clip`
+        virtual void set_clip(int top, int bottom) = 0;
+        virtual void clear_clip() = 0;
+
+        // Moves `height` rows of the buffer from `src_y` to `dst_y`
+        virtual void copy_rows(int src_y, int dst_y, int width, int height) = 0;
+
+        // Copies part of the buffer to the window. This may wait until `flush`.
+        virtual void present(int x, int y, int width, int height) = 0;
+
+        // Sends whatever `present` held back
+        virtual void flush();
+
+        // Called with events that nothing else handled
+        virtual void on_event(XEvent &event);
+
+        // Called once the first frame is out, to do setup that waits on the
+        // server. Returns the number of round trips it made.
+        virtual unsigned int finish_setup();
+
+        // Name of the backend, for the debug overlay
+        virtual const char * name() const = 0;
+};
+
+// Draws into a pixmap on the server
+class server_canvas : public canvas {
+    public:
+        server_canvas(Display * dis, Window win, GC gc, int width, int height);
+
+        ~server_canvas() override;
+
+        void resize(int width, int height) override;
+        void set_color(unsigned long pixel) override;
+        void fill_rect(int x, int y, int width, int height) override;
+        void draw_rect(int x, int y, int width, int height) override;
+        void draw_hline(int x1, int x2, int y) override;
+        void draw_string(int x, int baseline, const char * const str, size_t len) override;
+        void set_clip(int top, int bottom) override;
+        void clear_clip() override;
+        void copy_rows(int src_y, int dst_y, int width, int height) override;
+        void present(int x, int y, int width, int height) override;
+        const char * name() const override;
+
+    private:
+        Display * dis;
+        Window win;
+        GC gc;
+        Pixmap buffer;
+        int width;
+        int height;
+        // The foreground the GC already has, so that it isn't set again
+        unsigned long color;
+};
+
+// Every glyph of a core font as a bitmap, read back from the server once
+struct glyph_atlas {
+    // Each glyph is drawn in a cell this wide, with its origin `origin_x` from the
+    // left of the cell and `ascent` from the top
+    int cell_width;
+    int cell_height;
+    int origin_x;
+    int ascent;
+    // Distance the pen moves after each glyph
+    int advance[256];
+    // Columns [ink_left, ink_right) of each cell have something in them
+    unsigned char ink_left[256];
+    unsigned char ink_right[256];
+    // One byte per pixel, 1 where the glyph is drawn. Cells are next to each other,
+    // so a row of the atlas is `256 * cell_width` bytes.
+    std::vector<unsigned char> mask;
+};
+
+// Draws into an image on this side, using a glyph atlas for text, and sends
+// it with MIT-SHM if the server shares memory with us or with XPutImage if it
+// doesn't. A frame costs the same few requests however many rows are drawn.
+class image_canvas : public canvas {
+    public:
+        // Returns nullptr if the visual isn't one this can draw into: it needs
+        // TrueColor with 32 bits per pixel. `round_trips` is increased by the
+        // number of round trips made to build the glyph atlas.
+        static image_canvas * create(Display * dis, Window win, GC gc, int width, int height, unsigned int &round_trips);
+
+        ~image_canvas() override;
+
+        void resize(int width, int height) override;
+        void begin() override;
+        void set_color(unsigned long pixel) override;
+        void fill_rect(int x, int y, int width, int height) override;
+        void draw_rect(int x, int y, int width, int height) override;
+        void draw_hline(int x1, int x2, int y) override;
+        void draw_string(int x, int baseline, const char * const str, size_t len) override;
+        void set_clip(int top, int bottom) override;
+        void clear_clip() override;
+        void copy_rows(int src_y, int dst_y, int width, int height) override;
+        void present(int x, int y, int width, int height) override;
+        void flush() override;
+        void on_event(XEvent &event) override;
+        unsigned int finish_setup() override;
+        const char * name() const override;
+
+    private:
+        Display * dis;
+        Window win;
+        GC gc;
+        Visual * visual;
+        int depth;
+        glyph_atlas atlas;
+        XImage * image;
+        // Set once the server has attached to shared memory; until then, and if it
+        // never does, images are sent with XPutImage
+        bool use_shm;
+        XShmSegmentInfo shm;
+        int completion_type;
+        // True while the server may still be reading from the shared image
+        bool shm_busy;
+        // True if pixels have to be byte swapped for the server
+        bool swap_bytes;
+        uint32_t color;
+        int clip_top;
+        int clip_bottom;
+        // Rectangles waiting for `flush`, as x, y, width and height
+        int presents[MAX_PRESENTS][4];
+        size_t num_presents;
+
+        image_canvas(Display * dis, Window win, GC gc);
+
+        // Creates the image, in shared memory if `use_shm` is set and that works.
+        // Clears `use_shm` if it doesn't. Returns false if it can't be drawn into.
+        bool create_image(int width, int height);
+        void destroy_image();
+        bool attach_shm(int width, int height);
+        bool build_atlas(unsigned int &round_trips);
+        void wait_for_server();
+
+        // Clips [x, x + width) by [y, y + height) to the buffer and the clip band.
+        // Returns false if nothing is left.
+        bool clip(int &x, int &y, int &width, int &height) const;
+};
+
+#endif
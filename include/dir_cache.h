@@ -0,0 +1,152 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_CACHE_H
+#define INCLUDE_DIR_CACHE_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "dir_listing.h"
+
+// Memory budget for cached listings if FX_CACHE_MB isn't set
+const size_t DIR_CACHE_DEFAULT_BUDGET = 64 * 1024 * 1024;
+// Upper bound on the number of cached directories, regardless of size. Each one
+// holds an inotify watch.
+const size_t DIR_CACHE_MAX_ENTRIES = 32;
+
+struct cache_slot {
+    char * path;
+    dir_listing * listing;
+    int wd;
+    // The listing's memory usage when it was cached
+    size_t bytes;
+    unsigned long last_used;
+};
+
+// Keeps the listings of recently visited directories around so that going back to
+// one doesn't touch the filesystem. Every cached directory has an inotify watch, and
+// a listing is dropped as soon as anything in its directory changes, so whatever
+// is in the cache is up to date. The least recently used listings are evicted to
+// stay under the memory budget.
+//
+// The cache also watches the directory on screen. Changes to it are queued up and
+// applied to the listing in batches with `apply_changes`, so the listing on screen
+// stays current and can still be cached when we leave. If the changes can't be
+// applied (the directory was deleted, or inotify dropped events), the listing is
+// marked as out of date instead.
+class dir_cache {
+    public:
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long invalidations;
+
+        dir_cache(size_t budget);
+
+        dir_cache(const dir_cache &other) = delete;
+        dir_cache &operator=(const dir_cache &other) = delete;
+
+        ~dir_cache();
+
+        // Makes `path` the current directory. If there's a cached listing for it,
+        // swaps it into `listing` and returns true. Otherwise starts watching `path`
+        // and returns false.
+        bool enter(const char * const path, dir_listing &listing);
+
+        // Called before moving away from the current directory. Moves `listing` into
+        // the cache if it's `complete` and up to date, and leaves `listing` empty.
+        void leave(dir_listing &listing, bool complete);
+
+        // Reads pending inotify events and drops any listing that's out of date.
+        // Changes to the current directory are queued up for `apply_changes`. Call
+        // this when `fd` is readable.
+        void on_inotify();
+
+        // True if there are changes to the current directory waiting to be applied
+        bool has_changes() const;
+
+        // When the oldest queued change arrived, in nanoseconds on the monotonic clock
+        unsigned long long changes_since() const;
+
+        // Applies every queued change to `listing`, which must be the complete
+        // listing of the current directory. New entries only have their file type
+        // filled in; entries that were changed are reset to META_NONE so they get
+        // stat'd again. Each name is looked up with a binary search, and the whole
+        // batch costs one pass over the listing at most.
+        void apply_changes(dir_listing &listing);
+
+        // False if the current directory changed in a way that `apply_changes`
+        // can't follow, and needs to be loaded again
+        bool current_up_to_date() const;
+
+        // True if `path` is cached or is the current directory
+        bool contains(const char * const path) const;
+
+        // Starts watching `path` before it's loaded in the background, so that
+        // changes made during the load aren't missed. Abandons any other prefetch.
+        // Returns false if it can't be watched, in which case it can't be cached
+        // either.
+        bool begin_prefetch(const char * const path);
+
+        // Moves the listing of the directory from `begin_prefetch` into the cache,
+        // unless it changed while it was loading, and leaves `listing` empty
+        void finish_prefetch(dir_listing &listing);
+
+        void cancel_prefetch();
+
+        int fd() const;
+
+        size_t size() const;
+
+        size_t memory_usage() const;
+
+    private:
+        int inotify_fd;
+        size_t budget;
+        cache_slot slots[DIR_CACHE_MAX_ENTRIES];
+        size_t num_slots;
+        size_t used_bytes;
+        // Incremented on every `leave`, for LRU ordering
+        unsigned long clock;
+        char current_path[PATH_MAX + 1];
+        int current_wd;
+        bool current_valid;
+        // The directory being prefetched, if `prefetch_wd` isn't -1. It's only cached
+        // if nothing happens to it in the meantime.
+        char prefetch_path[PATH_MAX + 1];
+        int prefetch_wd;
+        bool prefetch_valid;
+        // Changes to the current directory that haven't been applied yet: names in
+        // the order the events arrived, and the event mask for each
+        dir_listing changes;
+        std::vector<uint32_t> change_masks;
+        unsigned long long first_change_ns;
+        // Storage from an evicted listing, reused by the next `leave`
+        dir_listing * spare;
+
+        // Moves `listing` into a new slot for `path` that owns the watch `wd`, then
+        // evicts the least recently used listings until it's under budget
+        void insert(const char * const path, int wd, dir_listing &listing);
+
+        void evict(size_t slot);
+
+        // Removes the watch `wd` if nothing else is using it
+        void release_watch(int wd);
+};
+
+#endif
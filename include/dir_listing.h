@@ -0,0 +1,187 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_LISTING_H
+#define INCLUDE_DIR_LISTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "name_sort.h"
+
+// Whether an entry's mode, uid and gid are known yet. Until they are, only the
+// file type from the dirent is filled in.
+const unsigned char META_NONE = 0;
+const unsigned char META_REQUESTED = 1;
+const unsigned char META_DONE = 2;
+
+// Bits of an entry's flags, which are worked out once from its mode and name when
+// it's added or its metadata arrives. The loops that run for every row on every
+// frame read these instead of decoding the mode again.
+const uint8_t ENTRY_DIR = 1;
+// From the dirent, so it's still set once the metadata (of the target) arrives
+const uint8_t ENTRY_SYMLINK = 2;
+const uint8_t ENTRY_HIDDEN = 4;
+// The current user can read the file or enter the directory. Set until the
+// metadata says otherwise.
+const uint8_t ENTRY_PERMITTED = 8;
+
+struct path_segment {
+    // Offset of the name in the listing's name pool. Names are stored back to back,
+    // each followed by a null terminator
+    uint32_t name_offset;
+    uint32_t len;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    unsigned char meta;
+    // Set by `dir_listing::remove`. The entry stays where it is (so load order
+    // indices don't change) but is no longer in the sorted order.
+    bool removed;
+};
+
+// The contents of one directory. Names are packed into a single pool and entries
+// refer to them by offset, so a listing costs a few dozen bytes per entry instead of
+// a fixed-size slot. `clear` keeps all of the storage around; once a listing has grown
+// to fit the largest directory visited, loading another one doesn't allocate.
+class dir_listing {
+    public:
+        dir_listing();
+
+        dir_listing(const dir_listing &other) = delete;
+        dir_listing &operator=(const dir_listing &other) = delete;
+
+        ~dir_listing();
+
+        // Removes all entries without freeing anything
+        void clear();
+
+        // Exchanges contents and storage with `other`
+        void swap(dir_listing &other);
+
+        // Makes this a copy of `other`, keeping this listing's storage if it's big
+        // enough. Each array is copied in one go, so this costs about as much as
+        // copying the memory.
+        void copy_from(const dir_listing &other);
+
+        // Sets every entry whose metadata was requested but never arrived back to
+        // META_NONE, so that it gets requested again
+        void forget_requests();
+
+        // Bytes of storage held by this listing, used or not
+        size_t memory_usage() const;
+
+        // Copies `name` into the pool and appends a new entry for it, with the file
+        // type bits of `mode` (or 0 if the type isn't known). The new entry is
+        // appended to the end of the sorted order; call `sort` once all entries have
+        // been added.
+        path_segment &add(const char * const name, size_t len, unsigned int mode = 0);
+
+        // Fills in the metadata of the `index`th entry and marks it META_DONE
+        void set_meta(size_t index, unsigned int mode, unsigned int uid, unsigned int gid);
+
+        // Sorts the entries by name, byte by byte. Only the order changes; the
+        // entries themselves stay where they are.
+        void sort();
+
+        // Sorts the entries from `start` onwards and merges them into the rows
+        // before `start`, which must already be sorted. This is linear in the size
+        // of the listing, so entries can be added a batch at a time without
+        // re-sorting everything.
+        void sort_from(size_t start);
+
+        // Like `sort_from`, but inserts each new entry into place with a binary
+        // search. Meant for a handful of entries at a time; larger batches fall back
+        // to `sort_from`.
+        void insert_from(size_t start);
+
+        // Finds `name` among the sorted rows with a binary search. Returns true and
+        // sets `row` to its row if it's there, otherwise sets `row` to the row where
+        // it would go.
+        bool find(const char * const name, size_t len, size_t * row) const;
+
+        // Like `find`, but only searches the first `num_rows` rows
+        bool find(const char * const name, size_t len, size_t * row, size_t num_rows) const;
+
+        // Marks the entry at `row` as removed. It stays in the sorted order (so rows
+        // don't shift and `find` still works) until `remove_marked` is called.
+        void remove(size_t row);
+
+        // Drops every removed entry from the sorted order in one pass
+        void remove_marked();
+
+        // Rebuilds the storage without removed entries, with entries in sorted order.
+        // This changes load order indices.
+        void compact();
+
+        // Number of rows, not counting removed entries
+        size_t size() const;
+
+        // Returns the entry at row `row` in sorted order
+        path_segment &at(size_t row);
+
+        // Returns the `index`th entry that was added, regardless of sorting or removal
+        path_segment &entry(size_t index);
+        const path_segment &entry(size_t index) const;
+
+        // Number of entries, including removed ones. These are the valid arguments to
+        // `entry`.
+        size_t num_entries() const;
+
+        // Returns the load order index of the entry at row `row`
+        uint32_t index_at(size_t row) const;
+
+        // Returns the ENTRY_* flags of the `index`th entry
+        uint8_t flags(size_t index) const;
+
+        // Returns the ENTRY_* flags of the entry at row `row`
+        uint8_t flags_at(size_t row) const;
+
+        // Returns the null-terminated name of `path`. Adding an entry may move the
+        // name pool, so this pointer is only valid until the next call to `add`.
+        const char * name(const path_segment &path) const;
+
+        // Every name in load order, each followed by a null terminator
+        const char * name_pool() const;
+        size_t name_pool_size() const;
+
+        // The load order index of every row, in sorted order. There are `size()` of them.
+        const uint32_t * sorted_indices() const;
+
+    private:
+        char * names;
+        size_t names_len;
+        size_t names_cap;
+        path_segment * entries;
+        // ENTRY_* flags of each entry, next to each other so that going through the
+        // rows on screen doesn't pull in the rest of each entry
+        uint8_t * entry_flags;
+        // Indices into `entries` in sorted order
+        uint32_t * order;
+        // Scratch space for `sort_from`
+        uint32_t * merge_buf;
+        sort_key * keys;
+        // Number of entries, including removed ones
+        size_t count;
+        // Number of entries in `order`
+        size_t num_rows;
+        size_t cap;
+
+        void reserve_names(size_t min_cap);
+        void reserve_entries(size_t min_cap);
+};
+
+#endif
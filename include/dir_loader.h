@@ -0,0 +1,135 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_LOADER_H
+#define INCLUDE_DIR_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <linux/limits.h>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "dir_listing.h"
+#include "dir_reader.h"
+#include "stat_pool.h"
+
+// Returned by `dir_loader::take`. Any other (positive) value is the errno that
+// stopped the load.
+const int LOAD_IN_PROGRESS = -1;
+const int LOAD_DONE = 0;
+
+// Number of entries stat'd between checks for cancellation. Results are also
+// handed over at this granularity.
+const size_t LOADER_CANCEL_CHECK_INTERVAL = 128;
+
+struct stat_result {
+    uint32_t index;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+};
+
+// Loads directories on a background thread so that the event loop never waits on
+// the filesystem. Loading happens in two parts: names (with the file type from the
+// dirent) are read right away and handed over in batches as they come in, but the
+// rest of the metadata is only looked up for entries that are asked for with
+// `request_stats`. Requests are served ahead of reading more names. The loader's
+// eventfd becomes readable whenever there is something new to `take`.
+//
+// Requests carry the entry's name, so the loader doesn't need its own copy of the
+// listing; it only needs the directory to be open.
+class dir_loader {
+    public:
+        // `stat_threads` are the threads that look up metadata alongside the worker
+        dir_loader(unsigned int stat_threads = STAT_POOL_THREADS);
+
+        dir_loader(const dir_loader &other) = delete;
+        dir_loader &operator=(const dir_loader &other) = delete;
+
+        ~dir_loader();
+
+        // Abandons the current load (if any) and starts loading `path`. Nothing
+        // from the abandoned load will be returned by `take` after this.
+        void load(const char * const path);
+
+        // Like `load`, but for a directory whose listing is already in memory. Only
+        // opens the directory so that `request_stats` works; `take` returns LOAD_DONE
+        // with no new entries.
+        void attach(const char * const path);
+
+        // Abandons the current load and closes the directory. `take` returns LOAD_DONE
+        // with nothing new until the next `load`.
+        void cancel();
+
+        // Appends every entry loaded since the last call to `dest`, unsorted, and
+        // fills in any metadata that has been looked up since the last call. Returns
+        // LOAD_IN_PROGRESS until all the names have been read, then LOAD_DONE or
+        // an errno.
+        int take(dir_listing &dest);
+
+        // Queues a metadata lookup for every entry in rows [first_row, last_row) of
+        // `listing` that doesn't have one yet. Earlier requests are served first.
+        void request_stats(dir_listing &listing, size_t first_row, size_t last_row);
+
+        int fd() const;
+
+        // Times the loader's filesystem calls into `perf`. Call this before the
+        // first load.
+        void set_perf(perf_stats * perf);
+
+    private:
+        std::thread worker;
+        std::mutex lock;
+        std::condition_variable wake;
+        // Bumped by every call to `load`. The worker compares this against the
+        // load it is working on and gives up as soon as they differ.
+        std::atomic<unsigned long> generation;
+        char path[PATH_MAX + 1];
+        bool stopping;
+        // True if the current load should read names, false if it's from `attach`
+        bool read_names;
+        bool done;
+        int error;
+        int event_fd;
+        // Guarded by `lock`. The nth request is for the entry with load order index
+        // request_indices[n] in the caller's listing.
+        dir_listing pending;
+        dir_listing requests;
+        std::vector<uint32_t> request_indices;
+        std::vector<stat_result> results;
+        // Only touched by the worker
+        dir_reader reader;
+        dir_listing batch;
+        dir_listing working;
+        std::vector<uint32_t> working_indices;
+        stat_pool stats;
+
+        void start(const char * const path, bool read_names);
+
+        void worker_loop();
+
+        void load_names(unsigned long gen);
+
+        // Returns false if the load was cancelled
+        bool serve_requests(unsigned long gen);
+
+        void notify();
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_MODEL_H
+#define INCLUDE_DIR_MODEL_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "dir_cache.h"
+#include "dir_listing.h"
+#include "dir_loader.h"
+#include "dir_prefetcher.h"
+#include "dir_sizer.h"
+#include "listing_snapshot.h"
+#include "name_filter.h"
+#include "perf_stats.h"
+#include "tree_search.h"
+
+// Everything fx knows about the directory on screen, without anything to do with
+// drawing it: the current path, its listing and how it's loaded and cached, the
+// filter, the recursive search and directory sizes. The window turns input into
+// calls on this and draws whatever it says is shown, so all of this can be driven
+// and measured without a display.
+//
+// The loader, cache, search, sizer and prefetcher each have an fd that becomes
+// readable when they have something new; the matching `on_*` function should be
+// called then.
+class dir_model {
+    public:
+        // Starts loading `path`. `cache_budget` is the memory budget for the listings
+        // of directories that were visited before.
+        dir_model(const char * const path, size_t cache_budget);
+
+        dir_model(const dir_model &other) = delete;
+        dir_model &operator=(const dir_model &other) = delete;
+
+        const char * cwd() const;
+        size_t cwd_len() const;
+
+        // Moves into `name`, relative to the current directory. The name is copied
+        // before anything else happens, so it can point into the listing. Returns
+        // false without moving if the path would be longer than PATH_MAX.
+        bool navigate(const char * const name, size_t len);
+
+        // Moves to the absolute path `path`, which has to be normalized like getcwd's
+        // result. Paths longer than PATH_MAX are ignored.
+        void open(const char * const path);
+
+        // Saves the listing to disk if it's done and big enough to be worth it, so
+        // that the next fx to start here can show it right away. Leaving a directory
+        // does this too.
+        void save_snapshot();
+
+        // Appends `name` to the path in `wd`. "." does nothing and ".." removes the
+        // last part of the path.
+        static void path_join(char * const wd, size_t * wd_len, const char * const name, size_t name_len);
+
+        // True if `path_join` with `name` on a path of `wd_len` stays within PATH_MAX
+        static bool join_fits(size_t wd_len, const char * const name, size_t name_len);
+
+        // Takes whatever the loader has. Returns LOAD_IN_PROGRESS, LOAD_DONE, or the
+        // errno that stopped the load; in that case we've already gone up a level, or
+        // back to where the search started if the directory was a search result.
+        int on_load_progress();
+
+        // True once the listing holds the whole directory
+        bool is_load_done() const;
+
+        // Reads inotify events. Returns true if the current directory has to be
+        // loaded again, which has already been started.
+        bool on_cache_event();
+
+        // True if there are changes to the current directory waiting to be applied
+        bool has_live_changes() const;
+
+        // When the oldest waiting change arrived, in nanoseconds on the monotonic clock
+        unsigned long long live_changes_since() const;
+
+        // Applies the waiting changes. `top` is the entry at the top of the screen;
+        // returns the position of the same entry afterwards, or of the entry after it
+        // if it was deleted.
+        size_t apply_live_changes(size_t top);
+
+        // Shows only the entries whose names contain `query`. An empty query shows
+        // everything.
+        void set_filter(const char * const query, size_t len);
+
+        void clear_filter();
+
+        bool is_filtered() const;
+
+        // Matches the filter against the listing again if the listing changed since
+        // the filter last looked. Batches that arrive in the meantime cost one rematch.
+        void update_filter();
+
+        // Searches everything below the current directory for names that contain
+        // `query`, up to `max_depth` levels down. Results are shown instead of the
+        // listing until `stop_search`.
+        void start_search(const char * const query, size_t len, int max_depth);
+
+        void stop_search();
+
+        bool is_searching() const;
+
+        // True until the search has gone through the whole tree
+        bool is_search_running() const;
+
+        // Takes the matches found since the last call. Returns true if they're on
+        // screen.
+        bool on_search_progress();
+
+        size_t search_dirs_searched();
+
+        // Takes the directory sizes that changed since the last call. Returns the
+        // update number that they're stamped with, or 0 if nothing changed.
+        uint32_t on_size_progress();
+
+        // Returns the size of the directory with load order index `index` in the
+        // listing, or nullptr if nothing is known about it yet
+        const dir_size * size_of(uint32_t index) const;
+
+        // Number of entries shown: the search results, the filter's matches, or the
+        // whole listing
+        size_t num_shown() const;
+
+        // Returns the row of `shown_listing()` that's shown as the `i`th entry
+        size_t shown_row(size_t i) const;
+
+        // The search results while searching, otherwise the listing
+        dir_listing &shown_listing();
+
+        // The listing of the current directory
+        const dir_listing &listing() const;
+
+        // Asks the loader for the metadata of shown entries [first, last)
+        void request_shown_stats(size_t first, size_t last);
+
+        // Prefetches the directory shown as entry `entry` into the cache, or if it's
+        // already there, the one after or before it. The entry under the mouse
+        // preempts a prefetch of its neighbours. Does nothing while the current
+        // directory is loading or while searching, so that prefetches never hold
+        // up what's on screen.
+        void prefetch_around(size_t entry);
+
+        // Takes whatever the prefetcher has. Returns true when a prefetch finished,
+        // so the next one can start.
+        bool on_prefetch_progress();
+
+        const dir_prefetcher &get_prefetcher() const;
+
+        const dir_cache &get_cache() const;
+
+        const listing_snapshots &get_snapshots() const;
+
+        // Timings for the last navigation. Set `enabled` to start collecting them.
+        perf_stats &get_perf();
+
+        int load_fd() const;
+        int cache_fd() const;
+        int search_fd() const;
+        int size_fd() const;
+        int prefetch_fd() const;
+
+    private:
+        perf_stats perf;
+        // https://insanecoding.blogspot.com/2007/11/pathmax-simply-isnt.html
+        // I am using PATH_MAX anyway. If you have a path longer than PATH_MAX, you have bigger problems
+        // than a buffer overflow in a silly file explorer
+        char path[PATH_MAX + 1];
+        size_t path_len;
+        dir_loader loader;
+        dir_cache cache;
+        bool load_done;
+        dir_listing children;
+        // Sizes of the directories in `children`, by load order index. They're filled
+        // in from the sizer as they come in, so nothing ever waits for them.
+        dir_sizer sizer;
+        std::vector<dir_size> sizes;
+        // The rows of `children` that match the filter. When it's active, they're
+        // shown instead of the whole listing.
+        name_filter filter;
+        // True if `children` changed since the filter last looked at it
+        bool filter_stale;
+        // While `searching` is set, `search_results` are shown instead of `children`
+        tree_search search;
+        dir_listing search_results;
+        bool searching;
+        bool search_running;
+        // Length of the search's root if `path` was entered from its results, else 0.
+        // A result can be several levels down, so if it can't be read, we go back to
+        // the root instead of up one level.
+        size_t search_root_len;
+        dir_prefetcher prefetcher;
+        listing_snapshots snapshots;
+        // True if `children` came from a snapshot and no entries have changed since,
+        // so there's nothing new to save
+        bool from_snapshot;
+
+        // Leaves the old directory and starts showing the one in `path`
+        void enter_path();
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_PREFETCHER_H
+#define INCLUDE_DIR_PREFETCHER_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <vector>
+#include "dir_cache.h"
+#include "dir_listing.h"
+#include "dir_loader.h"
+
+// How long the mouse has to stay on a directory before it's prefetched. Rows that
+// are only passed over on the way somewhere else aren't.
+const int PREFETCH_DWELL_MS = 150;
+
+// Directories with more entries than this aren't prefetched. They'd take as long
+// as a real load and push everything else out of the cache.
+const size_t PREFETCH_MAX_ENTRIES = 20000;
+
+// Rows at the top of a prefetched listing whose metadata is looked up, a screen
+// or so. The rest is looked up when it's scrolled to, as in any cached listing.
+const size_t PREFETCH_STAT_ROWS = 100;
+
+// Prefetched directories that are kept track of until they're entered. Past this,
+// the oldest one is counted as wasted.
+const size_t PREFETCH_MAX_READY = 8;
+
+// Loads directories that are likely to be entered next into the cache, so that
+// entering one is a swap instead of a load. Only one directory is prefetched at a
+// time, on a loader with no stat threads of its own, so it never takes much away
+// from the directory on screen. Names are read and sorted, the first screen of
+// metadata is looked up, and the listing goes into the cache under a watch that
+// was set up before the load started. The eventfd becomes readable whenever
+// there's progress for `on_progress`.
+class dir_prefetcher {
+    public:
+        // Prefetched directories that were entered while they were still cached
+        unsigned long hits;
+        // Prefetched directories that were left behind, or had been evicted or
+        // changed by the time they were entered
+        unsigned long wasted;
+        // Prefetches that were given up on before they finished: to navigate, for a
+        // better candidate, or because the directory was too big or unreadable
+        unsigned long abandoned;
+
+        dir_prefetcher();
+
+        dir_prefetcher(const dir_prefetcher &other) = delete;
+        dir_prefetcher &operator=(const dir_prefetcher &other) = delete;
+
+        ~dir_prefetcher();
+
+        // Starts loading `path`, an absolute path, into `cache`. Whatever was being
+        // prefetched is abandoned.
+        void start(const char * const path, dir_cache &cache);
+
+        // Abandons the prefetch in progress, if there is one
+        void cancel(dir_cache &cache);
+
+        bool is_running() const;
+
+        // True if `path` is being prefetched, or was and hasn't been entered yet
+        bool has(const char * const path) const;
+
+        // Takes whatever the loader has. Returns true when the listing is done and
+        // has gone into the cache.
+        bool on_progress(dir_cache &cache);
+
+        // Called after entering `path`. `cached` is true if its listing came from
+        // the cache. Counts a hit if it was prefetched; every other prefetched
+        // directory was passed up, and is counted as wasted.
+        void on_enter(const char * const path, bool cached);
+
+        int fd() const;
+
+    private:
+        dir_loader loader;
+        dir_listing listing;
+        char path[PATH_MAX + 1];
+        bool running;
+        // True once all the names are in and sorted and the first rows' metadata
+        // has been asked for
+        bool names_done;
+        // Prefetched directories that haven't been entered yet, oldest first.
+        // Allocated with strdup.
+        std::vector<char *> ready;
+};
+
+#endif
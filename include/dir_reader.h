@@ -0,0 +1,77 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_READER_H
+#define INCLUDE_DIR_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "dir_listing.h"
+#include "perf_stats.h"
+
+// Size of the buffer passed to getdents64. One call returns as many entries as fit,
+// so a bigger buffer means fewer syscalls (and fewer round trips on NFS).
+const size_t DIRENT_BUF_SIZE = 128 * 1024;
+
+// Reads the entries of one directory in large batches. The directory stays open
+// until the next call to `open` or `close`, and metadata is looked up relative to
+// its fd so that the kernel never has to walk the full path again.
+class dir_reader {
+    public:
+        dir_reader();
+
+        dir_reader(const dir_reader &other) = delete;
+        dir_reader &operator=(const dir_reader &other) = delete;
+
+        ~dir_reader();
+
+        // `extra_flags` are passed to open(2) along with O_DIRECTORY, e.g. O_NOFOLLOW
+        void open(const char * const path, int extra_flags = 0);
+
+        void close();
+
+        // Appends the next batch of entries to `listing` and returns the number of
+        // entries added. Returns 0 once the whole directory has been read. The
+        // file type from the dirent is filled in; permissions and ownership are
+        // left as 0 until `stat_entry` is called.
+        size_t read_batch(dir_listing &listing);
+
+        // Fills in the mode, uid and gid of the `index`th entry of `listing`. If the
+        // entry can't be stat'd (for example a dangling symlink), keeps the file type
+        // from the dirent and returns false. Safe to call from several threads at
+        // once, as long as they don't share an entry.
+        bool stat_entry(dir_listing &listing, size_t index) const;
+
+        int fd() const;
+
+        // Returns the device that the open directory is on
+        dev_t device() const;
+
+        // Times every getdents64 and statx call into `perf`, when it's enabled.
+        // Set this before the reader is used.
+        void set_perf(perf_stats * perf);
+
+    private:
+        perf_stats * perf;
+        int dir_fd;
+        char * buf;
+        size_t buf_len;
+        size_t buf_pos;
+        bool at_end;
+};
+
+#endif
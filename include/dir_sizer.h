@@ -0,0 +1,193 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_DIR_SIZER_H
+#define INCLUDE_DIR_SIZER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <linux/limits.h>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "dir_listing.h"
+#include "dir_reader.h"
+
+// Like the stat pool and the search, sizing is mostly waiting on the filesystem
+const unsigned int SIZER_THREADS = 8;
+
+// Upper bound on the number of directories whose sizes are remembered. When the
+// cache fills up it's emptied; it refills from whatever is being sized next.
+const size_t SIZE_CACHE_MAX_ENTRIES = 256 * 1024;
+
+// How long a remembered total is used for. A directory's key doesn't change when
+// something further down does, so an old total can be wrong by any amount; this
+// only has to cover going into a directory and back out, or up to its parent.
+const int SIZE_CACHE_MAX_AGE_MS = 10000;
+
+// Shortest time between two wakeups for partial totals. A finished total always
+// wakes the UI right away.
+const int SIZE_UPDATE_INTERVAL_MS = 50;
+
+// How much of a directory's size is known
+const unsigned char SIZE_NONE = 0;
+const unsigned char SIZE_PARTIAL = 1;
+const unsigned char SIZE_DONE = 2;
+
+struct dir_size {
+    // Disk usage of everything in the directory so far, in bytes
+    uint64_t bytes;
+    // The call to `dir_sizer::take` that last changed this size
+    uint32_t update;
+    unsigned char state;
+};
+
+// Identifies one version of a directory. A directory's mtime changes whenever an
+// entry is added, removed or renamed, so a cached total is thrown out when the
+// directory itself changes. It isn't when a file in it grows or when anything
+// deeper down changes, which is why cached totals also expire.
+struct size_key {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+
+    bool operator==(const size_key &other) const {
+        return this->dev == other.dev && this->ino == other.ino && this->mtime_ns == other.mtime_ns;
+    }
+};
+
+struct size_key_hash {
+    size_t operator()(const size_key &key) const {
+        return (key.ino * 0x9e3779b97f4a7c15ull) ^ (key.dev << 32) ^ key.mtime_ns;
+    }
+};
+
+// A remembered total, and when it was counted
+struct cached_size {
+    uint64_t bytes;
+    unsigned long long counted_ns;
+};
+
+// A directory that is being sized. Its total is ready once it has been read and
+// every subdirectory it found is ready; the total is then added to the parent's.
+// Everything but `path` and the key is guarded by the sizer's lock.
+struct size_node {
+    size_node * parent;
+    // Full path, allocated with malloc
+    char * path;
+    size_key key;
+    // False for the directories listed on screen, which haven't been stat'd yet
+    bool keyed;
+    // Set if the path turned out not to be a directory
+    bool failed;
+    // The entry on screen that this directory is under
+    uint32_t job;
+    unsigned long gen;
+    // The directory's own blocks, plus everything in it that has been counted
+    uint64_t bytes;
+    // 1 until the directory has been read, plus the subdirectories that aren't done
+    size_t pending;
+};
+
+// Works out the disk usage of every directory in a listing, on a pool of threads,
+// like `du -sx` on each one. Each subdirectory is a separate piece of work, so a
+// single large directory is still sized by every thread. Totals are cached by
+// directory for SIZE_CACHE_MAX_AGE_MS, so going back to a directory or up to its
+// parent soon after doesn't read the same directories again. Within that time,
+// a total can miss changes below the directory it's for. Running totals are
+// handed over as they grow, and the eventfd becomes readable when there is
+// something new to `take`.
+//
+// Symlinks aren't followed and other filesystems aren't entered. Hard links are
+// counted once per link.
+class dir_sizer {
+    public:
+        dir_sizer(unsigned int num_threads);
+
+        dir_sizer(const dir_sizer &other) = delete;
+        dir_sizer &operator=(const dir_sizer &other) = delete;
+
+        ~dir_sizer();
+
+        // Abandons the current job and starts sizing every directory in `listing`,
+        // which is the listing of `path`. Sizes are reported by load order index.
+        // Rows near the top of the listing are sized first.
+        void start(const char * const path, const dir_listing &listing);
+
+        // Also sizes the entries of the current listing from load order index
+        // `first` onwards, such as ones that were just added
+        void add(const dir_listing &listing, size_t first);
+
+        // Abandons the current job. Nothing from it will be returned by `take`
+        // after this.
+        void cancel();
+
+        // Copies every size that changed since the last call into `sizes`, indexed
+        // by load order index, and stamps them with a new update number. Returns the
+        // update number, or 0 if nothing changed.
+        uint32_t take(std::vector<dir_size> &sizes);
+
+        int fd() const;
+
+    private:
+        std::thread * threads;
+        unsigned int num_threads;
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stopping;
+        int event_fd;
+        // Bumped by every call to `start` and `cancel`
+        std::atomic<unsigned long> generation;
+        // Guarded by `lock`
+        char path[PATH_MAX + 1];
+        size_t path_len;
+        std::vector<size_node *> stack;
+        std::vector<dir_size> results;
+        // Load order indices of the results that changed since the last `take`
+        std::vector<uint32_t> changed;
+        std::vector<bool> dirty;
+        uint32_t num_updates;
+        bool notified;
+        long long last_notify_ns;
+
+        std::mutex cache_lock;
+        std::unordered_map<size_key, cached_size, size_key_hash> cache;
+
+        void worker_loop();
+
+        void measure(size_node * node, dir_reader &reader, dir_listing &batch);
+
+        // Called with `lock` held once a node has no more pending work. Adds its
+        // total to its parent and frees it, and does the same for the parent if
+        // that was the last thing it was waiting for.
+        void finish(size_node * node);
+
+        // Called with `lock` held. Adds `bytes` to the running total of `job`, or
+        // replaces it with the final total if `done`.
+        void publish(uint32_t job, uint64_t bytes, bool done);
+
+        // Returns true and sets `bytes` if `key` was sized recently enough
+        bool lookup(const size_key &key, uint64_t * bytes);
+
+        void remember(const size_key &key, uint64_t bytes);
+};
+
+#endif
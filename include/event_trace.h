@@ -0,0 +1,69 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_EVENT_TRACE_H
+#define INCLUDE_EVENT_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <X11/Xlib.h>
+
+// Start of every trace file, followed by the version
+const char TRACE_MAGIC[8] = { 'f', 'x', 't', 'r', 'a', 'c', 'e', '\0' };
+const uint32_t TRACE_VERSION = 1;
+
+// One handled X event. Keys are stored as keysyms rather than keycodes so that a
+// trace can be replayed on a server with a different keymap.
+struct trace_event {
+    // Time since the first event in the trace
+    uint64_t time_ns;
+    uint32_t type;
+    // Modifier and button mask
+    uint32_t state;
+    // Button for a button press, keysym for a key press
+    uint32_t detail;
+    int32_t x;
+    int32_t y;
+    // Size of the exposed area for an expose event
+    int32_t width;
+    int32_t height;
+};
+
+// Appends the events that fx handles to a file. Set FX_TRACE to a file name to
+// record a trace; `replay_bin` plays it back.
+class trace_writer {
+    public:
+        // Does nothing unless `path` is set
+        trace_writer(const char * const path);
+
+        bool is_recording() const;
+
+        void record(const XEvent &event);
+
+        ~trace_writer();
+
+    private:
+        FILE * out;
+        uint64_t first_ns;
+};
+
+// Reads a whole trace written by `trace_writer`. Throws if the file can't be read,
+// and returns false if it isn't a trace of this version.
+bool read_trace(const char * const path, std::vector<trace_event> &events);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_LIST_VIEW_H
+#define INCLUDE_LIST_VIEW_H
+
+#include <stddef.h>
+
+// The part of a list that is on screen. Entries don't know where they're drawn;
+// every conversion between a y coordinate and an entry is arithmetic on the
+// scroll position, so it costs the same for 10 entries or a million.
+class list_view {
+    public:
+        // `top` is the y coordinate of the top of the first row
+        list_view(int top, int row_height);
+
+        // Sets the number of entries and the height that the rows can take up, then
+        // clamps the scroll position to fit
+        void resize(size_t num_entries, int height);
+
+        // Scrolls by `delta` rows, as far as the list allows. Returns the number of rows
+        // actually scrolled.
+        int scroll_by(int delta);
+
+        // Scrolls so that `entry` is at the top, as far as the list allows
+        void scroll_to(size_t entry);
+
+        // Returns the row on screen under `y`, or -1 if there isn't an entry there
+        int screen_row_at(int y) const;
+
+        // Finds the entry under `y`. Returns false if there isn't one.
+        bool entry_at(int y, size_t * entry) const;
+
+        int row_top(int screen_row) const;
+
+        // The y coordinate of the baseline of the text in a row
+        int baseline(int screen_row) const;
+
+        // The entry in the top row
+        size_t first() const;
+
+        // Number of rows with an entry in them
+        int visible_rows() const;
+
+        // Number of rows that fit, whether or not there are entries for them
+        int capacity() const;
+
+        bool can_scroll() const;
+
+    private:
+        int top;
+        int row_height;
+        size_t num_entries;
+        int num_fit;
+        size_t first_entry;
+        size_t max_first;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_LISTING_SNAPSHOT_H
+#define INCLUDE_LISTING_SNAPSHOT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <linux/limits.h>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <thread>
+#include "dir_listing.h"
+
+const char SNAPSHOT_MAGIC[8] = { 'f', 'x', 's', 'n', 'a', 'p', '\0', '\0' };
+// Bump this whenever the layout below or the sort order changes. Snapshots from
+// other versions are thrown away.
+const uint32_t SNAPSHOT_VERSION = 1;
+
+// Directories smaller than this load quickly enough without a snapshot
+const size_t SNAPSHOT_MIN_ENTRIES = 2000;
+
+// Snapshots kept on disk. Past this, the least recently used are deleted.
+const size_t SNAPSHOT_MAX_FILES = 16;
+
+// A snapshot file is this header, then the path of the directory padded to 8
+// bytes, then `num_entries` snapshot_entries in sorted order, then the names, each
+// followed by a null terminator. Everything is in native byte order; the file is
+// only ever read by the machine that wrote it.
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    // Identity and modification time of the directory when the snapshot was
+    // taken. Adding, removing or renaming an entry changes the mtime.
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t path_len;
+    uint64_t num_entries;
+    uint64_t names_size;
+    // Of everything after the header
+    uint64_t checksum;
+};
+
+struct snapshot_entry {
+    uint32_t name_offset;
+    uint32_t len;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    // Whether mode, uid and gid are from a stat, and the entry's ENTRY_* flags
+    uint8_t meta;
+    uint8_t flags;
+    uint16_t padding;
+};
+
+// Listings of big directories saved to disk, so that fx can show them right away
+// the next time it starts in one instead of reading them again. Each snapshot is
+// a file in $XDG_CACHE_HOME/fx (or ~/.cache/fx) that's mapped in and checked
+// before anything in it is used: the header, a checksum of the rest, the bounds of
+// every name, the sort order, and finally that the directory is the same one with
+// the same mtime. Anything that fails a check is deleted. Names are trusted once
+// the snapshot checks out; metadata isn't, and is looked up again as entries come
+// on screen. Files are written to a temporary name and renamed into place, so a
+// reader never sees one half written.
+//
+// Saving only copies the listing, array by array. A thread of its own lays it out
+// in sorted order, writes the file and cleans up old snapshots. Only the latest
+// listing waiting to be written is kept; the thread finishes it before fx exits.
+//
+// Set FX_SNAPSHOTS=0 to turn snapshots off.
+class listing_snapshots {
+    public:
+        // Snapshots taken from a valid file
+        unsigned long loaded;
+        // Snapshot files that were out of date or corrupt, and deleted
+        unsigned long rejected;
+        // Counted by the writer thread once the file is in place
+        std::atomic<unsigned long> saved;
+
+        listing_snapshots();
+
+        listing_snapshots(const listing_snapshots &other) = delete;
+        listing_snapshots &operator=(const listing_snapshots &other) = delete;
+
+        ~listing_snapshots();
+
+        // Fills `listing`, which must be empty, from the snapshot of `path` if there's
+        // a valid one. Every entry is left as META_NONE with the metadata from the
+        // snapshot, so that it's shown right away and looked up again when asked for.
+        bool load(const char * const path, dir_listing &listing);
+
+        // Saves `listing`, the complete listing of `path`. `dir_stat` has to be from
+        // before the listing was last known to be up to date, so that a change in
+        // between leaves the snapshot with an old mtime instead of missing entries.
+        // Does nothing for small listings, or if there's already a snapshot of this
+        // version of the directory. The file is written in the background.
+        void save(const char * const path, const dir_listing &listing, const struct stat &dir_stat);
+
+    private:
+        // Where snapshots go, or empty if they're turned off
+        char dir[PATH_MAX + 1];
+        size_t dir_len;
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::thread writer;
+        bool stopping;
+        // The next listing to write, and where it's from. The writer swaps it
+        // with `writing`, so the two keep their storage between saves.
+        bool has_pending;
+        dir_listing pending;
+        char pending_path[PATH_MAX + 1];
+        struct stat pending_stat;
+        // Only touched by the writer
+        dir_listing writing;
+
+        // Writes the snapshot file name for `path` into `buf`. Returns false if it
+        // doesn't fit.
+        bool file_name(const char * const path, char (&buf)[PATH_MAX + 1]) const;
+
+        void writer_loop();
+
+        // Writes the snapshot of `listing`, which is `path` as of `dir_stat`, then trims
+        void write_file(const char * const path, const dir_listing &listing, const struct stat &dir_stat);
+
+        // Deletes the least recently used snapshots past SNAPSHOT_MAX_FILES
+        void trim();
+};
+
+#endif
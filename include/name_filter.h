@@ -0,0 +1,102 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_NAME_FILTER_H
+#define INCLUDE_NAME_FILTER_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dir_listing.h"
+
+// Narrowing down the matches visits them in sorted order, which jumps around the
+// name pool. Once more than one in this many entries match, it's faster to go
+// through the pool in order instead.
+const size_t FILTER_SCAN_RATIO = 16;
+
+// The rows of a listing whose names contain a query, ignoring ASCII case. Every
+// search scans the listing's whole name pool 16 bytes at a time, counting the null
+// terminators as it goes to tell which entry a match is in. A query that only got
+// longer keeps the previous results in sorted order and drops the rows that no
+// longer match, because a name can't contain the longer query without containing
+// the shorter one.
+class name_filter {
+    public:
+        name_filter();
+        name_filter(const name_filter &other) = delete;
+        name_filter &operator=(const name_filter &other) = delete;
+        ~name_filter();
+
+        // Sets the query and finds its matches in `listing`. The previous results are
+        // reused if `listing` hasn't changed since the last call and the old query
+        // is a prefix of the new one. An empty query turns the filter off.
+        void set_query(const dir_listing &listing, const char * const query, size_t len);
+
+        // Finds the matches again, after `listing` has changed
+        void rematch(const dir_listing &listing);
+
+        // True if there's a query
+        bool active() const;
+
+        // Number of matching rows
+        size_t size() const;
+
+        // Returns the listing row of the `i`th match. Matches are in sorted order.
+        size_t row(size_t i) const;
+
+        // Returns the number of matches before listing row `row`
+        size_t position_of(size_t row) const;
+
+    private:
+        // The query with ASCII letters in lowercase
+        char query[NAME_MAX + 1];
+        size_t query_len;
+        // Listing rows that match, in ascending order
+        uint32_t * rows;
+        size_t num_rows;
+        size_t rows_cap;
+        // One bit per entry in load order, set for the entries that match
+        uint64_t * hits;
+        // Scratch space for `refine`, the same size as `hits`
+        uint64_t * found;
+        // Words in each of the bitmaps
+        size_t hits_cap;
+
+        // Makes room for the matches in `listing`
+        void reserve(const dir_listing &listing);
+
+        // Sets the bits of the entries whose names contain the query
+        void scan_pool(const dir_listing &listing, uint64_t * const bits) const;
+
+        // Finds every match by scanning the whole name pool
+        void match_all(const dir_listing &listing);
+
+        // Drops the current matches that no longer match
+        void refine(const dir_listing &listing);
+
+        // Fills `rows` with the rows whose entries are flagged in `hits`
+        void collect_rows(const dir_listing &listing);
+
+        // Drops the rows whose entries are no longer flagged in `hits`
+        void narrow_rows(const dir_listing &listing);
+
+        // Returns the first occurrence of the query in the `len` byte string `str`, or
+        // nullptr. Up to `avail` bytes starting at `str` may be read.
+        const char * find(const char * const str, size_t len, size_t avail) const;
+};
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_NAME_SORT_H
+#define INCLUDE_NAME_SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What actually gets sorted: the first 8 bytes of the name packed into an integer
+// so that most comparisons never touch the name pool, and enough to find the rest
+// of the name when they do. 16 bytes, so four fit in a cache line.
+struct sort_key {
+    uint64_t prefix;
+    uint32_t name_offset;
+    uint32_t index;
+};
+
+// Returns the first 8 bytes of `name` as a big-endian integer, zero padded. Comparing
+// two of these as integers gives the same result as comparing the names byte by
+// byte, up to the first 8 bytes.
+uint64_t name_prefix(const char * const name, size_t len);
+
+// Compares two names as unsigned bytes, 8 bytes at a time
+int name_cmp(const char * const a, size_t a_len, const char * const b, size_t b_len);
+
+// Sorts `keys` by name using introsort: quicksort with a median-of-three pivot,
+// falling back to heapsort if the recursion gets too deep and to insertion sort
+// for short ranges. `names` is the pool that the keys' offsets point into; every
+// name in it must be null-terminated.
+void sort_keys(sort_key * const keys, size_t count, const char * const names);
+
+#endif
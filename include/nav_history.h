@@ -0,0 +1,83 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_NAV_HISTORY_H
+#define INCLUDE_NAV_HISTORY_H
+
+#include <deque>
+#include <stddef.h>
+
+// Most directories remembered in each direction. Past this, the oldest are
+// forgotten.
+const size_t HISTORY_MAX_ENTRIES = 64;
+
+struct history_entry {
+    // Absolute path, allocated with strdup
+    char * path;
+    // Row of the listing that was at the top of the screen
+    size_t top;
+};
+
+// Back and forward stacks of visited directories, like a web browser's. Each
+// entry is a path and where it was scrolled to. The listings themselves aren't
+// kept here: the directory cache holds on to them under its memory budget, so
+// going back costs no I/O as long as the directory is still cached and hasn't
+// changed. Otherwise it's loaded again, and the position is still restored.
+class nav_history {
+    public:
+        nav_history();
+
+        nav_history(const nav_history &other) = delete;
+        nav_history &operator=(const nav_history &other) = delete;
+
+        ~nav_history();
+
+        // Records leaving `path`, scrolled to `top`, for somewhere new. This forgets
+        // everything that was forward of it.
+        void push(const char * const path, size_t top);
+
+        // Steps back, leaving `path` scrolled to `top`, which becomes the next step
+        // forward. Returns the directory to go to, or nullptr if there's nothing to
+        // go back to. The entry is valid until the next call.
+        const history_entry * back(const char * const path, size_t top);
+
+        // Like `back`, in the other direction
+        const history_entry * forward(const char * const path, size_t top);
+
+        // Forgets the last directory that was left if it's `path`. For when a directory
+        // couldn't be entered and we went back to where we came from.
+        void drop_last(const char * const path);
+
+        // Returns the row that was at the top of the screen the last time `path`
+        // was left, or 0 if it isn't remembered
+        size_t position_of(const char * const path) const;
+
+        // Forgets everything
+        void clear();
+
+    private:
+        std::deque<history_entry> back_entries;
+        std::deque<history_entry> forward_entries;
+        // What `back` or `forward` last returned, freed on the next call
+        history_entry last;
+
+        // Moves the newest entry of `from` into `last`, after pushing `path` and
+        // `top` onto `to`
+        const history_entry * step(std::deque<history_entry> &from, std::deque<history_entry> &to, const char * const path, size_t top);
+};
+
+#endif
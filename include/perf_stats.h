@@ -0,0 +1,107 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_PERF_STATS_H
+#define INCLUDE_PERF_STATS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Latencies are counted in power of two buckets: bucket 0 is everything under 1 µs,
+// and bucket i is [2^(i-1), 2^i) µs. The last bucket takes everything from about
+// a second up.
+const size_t PERF_BUCKETS = 22;
+
+// Monotonic time in nanoseconds
+static inline unsigned long long perf_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Counts and a latency histogram for one kind of operation. Safe to record into
+// from several threads at once.
+class perf_histogram {
+    public:
+        perf_histogram();
+
+        void record(unsigned long long ns);
+
+        void reset();
+
+        uint64_t count() const;
+
+        uint64_t total_ns() const;
+
+        // Upper bound of the bucket that holds the `p`th percentile, in nanoseconds
+        uint64_t percentile(unsigned int p) const;
+
+        // Writes a one line summary: count, total, p50, p99 and max
+        int summarize(char * const buf, size_t buf_size, const char * const label) const;
+
+        // Writes the summary and every non-empty bucket
+        void dump(FILE * out, const char * const label) const;
+
+    private:
+        std::atomic<uint64_t> buckets[PERF_BUCKETS];
+        std::atomic<uint64_t> num_samples;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> max;
+};
+
+// What it cost to load the current directory. Everything is reset by `dir_model::navigate`,
+// so these describe the last navigation. Nothing is timed unless `enabled` is set;
+// when it isn't, instrumented code only pays for loading the flag.
+struct perf_stats {
+    std::atomic<bool> enabled;
+    // getdents64 calls
+    perf_histogram readdir;
+    // statx calls
+    perf_histogram stat;
+    // Sorting batches of new entries into the listing
+    perf_histogram sort;
+    // When the last navigation started and how long it took to read every name,
+    // or 0 if it hasn't finished
+    unsigned long long navigate_ns;
+    unsigned long long load_ns;
+
+    perf_stats();
+
+    void reset();
+
+    // Returns the current time if timing is enabled, otherwise 0. Pass the result
+    // to `stop`.
+    unsigned long long start() const {
+        return this->enabled.load(std::memory_order_relaxed) ? perf_now_ns() : 0;
+    }
+
+    // Records the time since `start` into `hist`, if timing was enabled then
+    static void stop(perf_histogram &hist, unsigned long long start) {
+        if (start != 0) {
+            hist.record(perf_now_ns() - start);
+        }
+    }
+};
+
+// Formats a duration in a few characters, e.g. "850ns", "42us" or "1.3ms"
+int format_ns(char * const buf, size_t buf_size, uint64_t ns);
+
+#endif
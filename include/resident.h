@@ -0,0 +1,66 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_RESIDENT_H
+#define INCLUDE_RESIDENT_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+
+// A resident fx, started with `fx_bin --daemon`, keeps its X connection, window
+// and directory caches between runs. Each run of `fx_bin` connects to it over a
+// Unix socket instead of starting from scratch: the client sends its working
+// directory, the resident fx shows its window there, and the client gets back
+// whatever fx would have printed when it exited.
+//
+// There is one socket per user and display, in XDG_RUNTIME_DIR or else /tmp.
+
+// What the resident fx sends instead of a result when its window is already open
+// for another client
+const char RESIDENT_BUSY[] = "busy\n";
+
+// How long the resident fx waits for a client to send its directory after connecting
+const int RESIDENT_REQUEST_TIMEOUT_MS = 1000;
+
+// Connects to the resident fx for this display. Returns -1 if there isn't one.
+int connect_resident();
+
+// Sends the current directory over `fd`, waits for the window to close and prints
+// what the resident fx sent back. Returns the exit status for the client, or -1 if
+// the resident fx is busy with another client and this one should open its own window.
+int run_resident_client(int fd);
+
+// Creates the socket that clients connect to. Throws if another resident fx is
+// already listening on it.
+int listen_resident();
+
+// Accepts the next client and reads the directory it wants opened into `cwd`.
+// Returns the client's fd, or -1 if the client went away or belongs to another
+// user.
+int accept_resident_client(int listen_fd, char (&cwd)[PATH_MAX + 1]);
+
+// Accepts the next client and tells it that the window is in use, without waiting
+// for its directory
+void refuse_resident_client(int listen_fd);
+
+// Sends what fx would have printed on exit to the client, and disconnects it
+void finish_resident_client(int fd, const char * const result, size_t len);
+
+// Removes the socket
+void close_resident(int listen_fd);
+
+#endif
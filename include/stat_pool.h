@@ -0,0 +1,77 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_STAT_POOL_H
+#define INCLUDE_STAT_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include "dir_listing.h"
+#include "dir_reader.h"
+
+// Stat calls are mostly waiting on the filesystem, so it pays to have more of
+// them in flight than there are cores
+const unsigned int STAT_POOL_THREADS = 8;
+// Jobs smaller than this are stat'd on the calling thread; waking the pool
+// costs more than it saves
+const size_t STAT_POOL_MIN_JOB = 64;
+// Number of entries a thread claims at a time
+const size_t STAT_POOL_CHUNK = 16;
+
+// A fixed set of worker threads that split up the stat calls for a listing. The
+// calling thread works too, and `stat_range` returns once every entry in the
+// range has been stat'd.
+class stat_pool {
+    public:
+        // `num_threads` is the number of extra threads; 0 makes the pool run
+        // everything on the calling thread
+        stat_pool(unsigned int num_threads);
+
+        stat_pool(const stat_pool &other) = delete;
+        stat_pool &operator=(const stat_pool &other) = delete;
+
+        ~stat_pool();
+
+        // Stats entries [start, end) of `listing`, in load order. The listing must
+        // not be modified until this returns.
+        void stat_range(dir_reader &reader, dir_listing &listing, size_t start, size_t end);
+
+    private:
+        std::thread * threads;
+        unsigned int num_threads;
+        std::mutex lock;
+        std::condition_variable job_ready;
+        std::condition_variable job_done;
+        // Incremented for each job so that workers can tell a new job from a spurious wakeup
+        unsigned long job_id;
+        // Number of workers that haven't finished the current job
+        unsigned int busy;
+        bool stopping;
+        dir_reader * job_reader;
+        dir_listing * job_listing;
+        std::atomic<size_t> next;
+        size_t job_end;
+
+        void worker_loop();
+
+        void work();
+};
+
+#endif
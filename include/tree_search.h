@@ -0,0 +1,136 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_TREE_SEARCH_H
+#define INCLUDE_TREE_SEARCH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <linux/limits.h>
+#include <mutex>
+#include <stddef.h>
+#include <sys/types.h>
+#include <thread>
+#include "dir_listing.h"
+#include "dir_reader.h"
+#include "name_filter.h"
+
+// Walking a tree is mostly waiting on getdents, so like the stat pool this uses
+// more threads than there are cores
+const unsigned int SEARCH_THREADS = 8;
+
+// How many levels below the starting directory a search goes by default
+const int SEARCH_DEFAULT_MAX_DEPTH = 32;
+
+// A directory waiting to be searched
+struct search_dir {
+    // Full path, allocated with malloc
+    char * path;
+    int depth;
+    // The search this directory belongs to. Directories from an older search are
+    // dropped when they come off a queue.
+    unsigned long gen;
+};
+
+// One walker thread and the directories it has found but not searched yet. A
+// walker takes the most recent directory from its own queue, which keeps its
+// working set small, and steals the oldest directory from another walker's queue
+// when its own is empty. The oldest directories are the shallowest ones, so a
+// steal usually takes a whole subtree.
+struct search_walker {
+    std::thread thread;
+    std::mutex lock;
+    std::deque<search_dir> dirs;
+    // Only touched by the walker
+    dir_reader reader;
+    dir_listing batch;
+    name_filter filter;
+    dir_listing found;
+};
+
+// Searches the subtree under a directory for names that contain a query, on a
+// pool of walker threads. Each directory is read with a `dir_reader` and matched
+// with a `name_filter`, like a regular directory. Matches are handed over as they're
+// found, as paths relative to the starting directory. Symlinks are not followed,
+// and the search never leaves the filesystem it started on. The eventfd becomes
+// readable whenever there is something new to `take`.
+class tree_search {
+    public:
+        tree_search(unsigned int num_threads);
+
+        tree_search(const tree_search &other) = delete;
+        tree_search &operator=(const tree_search &other) = delete;
+
+        ~tree_search();
+
+        // Abandons the current search (if any) and starts searching under `root`.
+        // Directories more than `max_depth` levels below `root` aren't read.
+        void start(const char * const root, const char * const query, size_t query_len, int max_depth);
+
+        // Abandons the current search. Nothing from it will be returned by `take`
+        // after this.
+        void cancel();
+
+        // Appends every match found since the last call to `dest`, unsorted. Returns
+        // true while the search is still going.
+        bool take(dir_listing &dest);
+
+        // Number of directories read so far in the current search
+        size_t dirs_searched();
+
+        int fd() const;
+
+    private:
+        search_walker * walkers;
+        unsigned int num_walkers;
+        std::mutex lock;
+        std::condition_variable wake;
+        // Bumped by every call to `start` and `cancel`
+        std::atomic<unsigned long> generation;
+        // Number of directories in all the queues. This can briefly go negative,
+        // since a directory can be stolen before it's counted.
+        std::atomic<long> queued;
+        bool stopping;
+        int event_fd;
+        // Guarded by `lock`
+        char query[NAME_MAX + 1];
+        size_t query_len;
+        int max_depth;
+        size_t root_len;
+        dev_t root_dev;
+        // Directories that have been queued but not finished. The search is done
+        // when this gets to 0.
+        size_t outstanding;
+        size_t num_searched;
+        bool done;
+        dir_listing results;
+
+        void walker_loop(unsigned int id);
+
+        // Takes a directory from walker `id`'s queue, or steals one from another
+        // walker. Returns false if every queue is empty.
+        bool pop(unsigned int id, search_dir * dir);
+
+        void push(unsigned int id, const search_dir &dir);
+
+        void search(unsigned int id, const search_dir &dir);
+
+        void notify();
+};
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDE_UTIL_H
+#define INCLUDE_UTIL_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+
+template <typename T>
+static void check_error(T val, T error_state) {
+    if (val == error_state) {
+        // perror is allowed to clobber errno
+        int err = errno;
+
+        perror(nullptr);
+
+        throw err;
+    }
+}
+
+template <typename T, size_t N>
+static constexpr size_t c_arr_size(const T(&)[N]) {
+    return N;
+}
+
+// True for the "." and ".." entries that every directory has
+static inline bool is_dot_or_dotdot(const char * const name, size_t len) {
+    return (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+#endif
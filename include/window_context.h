@@ -18,28 +18,71 @@
 #ifndef INCLUDE_WINDOW_CONTEXT_H
 #define INCLUDE_WINDOW_CONTEXT_H
 
-#include <dirent.h>
 #include <linux/limits.h>
 #include <sys/stat.h>
 #include <X11/Xlib.h>
+#include "canvas.h"
+#include "dir_model.h"
+#include "list_view.h"
+#include "nav_history.h"
 
 #define NO_EXIT             0
 #define USER_QUIT_EXIT_CODE 1
 #define USER_CD_EXIT_CODE   2
 
-const size_t MAX_CHILDREN = 1024;
-// Must be >= 256
-const size_t MAX_PATH_SEGMENT_SIZE = 256;
-
 const size_t ROW_HEIGHT = 13;
 
-struct path_segment {
-    char name[MAX_PATH_SEGMENT_SIZE];
-    size_t len;
-    int y_bot;
-    unsigned int mode;
-    unsigned int uid;
-    unsigned int gid;
+// Top of the first row, below the current directory
+const int LIST_TOP = 10;
+
+// Height of the statusline, below the line that separates it from the rows
+const int STATUS_HEIGHT = 10;
+
+// How far below its baseline a line of text reaches. Descenders spill into the
+// next row, so repainting a row also redraws the text of the row above it.
+const int TEXT_DESCENT = 3;
+
+// Shortest time between two frames. Input that arrives in the meantime is
+// gathered up and drawn in the next frame.
+const int FRAME_INTERVAL_MS = 16;
+
+// Number of separate bands that can be waiting to be repainted before the whole
+// window is repainted instead
+const size_t MAX_DAMAGE = 8;
+
+// How long to wait after a change to the current directory before showing it.
+// Everything that happens in the meantime is applied in the same batch.
+const int LIVE_UPDATE_DELAY_MS = 50;
+
+// Distance of the size column from the right edge of the window
+const int SIZE_COLUMN_WIDTH = 60;
+
+// Size of the box that debug mode draws its timings in, at the top right
+const int PERF_OVERLAY_WIDTH = 380;
+const int PERF_OVERLAY_LINES = 8;
+
+// The thumb buttons on the side of most mice. Xlib only names buttons 1 to 5.
+const unsigned int BACK_BUTTON = 8;
+const unsigned int FORWARD_BUTTON = 9;
+
+// What typed keys go to
+const unsigned char PROMPT_NONE = 0;
+const unsigned char PROMPT_FILTER = 1;
+const unsigned char PROMPT_SEARCH = 2;
+
+// How long it took to get the window on screen, from the start of setup or, for
+// a resident fx, from the client asking for it. Round trips are the requests on
+// the way that had to wait for the server to answer. Setup that isn't needed for
+// the first frame is done right after it, and counted separately.
+struct startup_stats {
+    unsigned long long start_ns;
+    // Time spent in XOpenDisplay
+    unsigned long long connect_ns;
+    // Time to the end of the first frame, or 0 until it's drawn
+    unsigned long long first_frame_ns;
+    unsigned int round_trips;
+    unsigned long long deferred_ns;
+    unsigned int deferred_round_trips;
 };
 
 class window_context {
@@ -56,11 +99,70 @@ class window_context {
 
         int on_motion(XMotionEvent &event);
 
+        // Tracks the window's size. Nothing else asks the server for it.
+        int on_configure(XConfigureEvent &event);
+
+        // Picks up changes to the keymap
+        int on_mapping(XMappingEvent &event);
+
+        // Handles events that nothing else does, e.g. from extensions
+        int on_other_event(XEvent &event);
+
+        // Handles the window manager closing the window
+        int on_client_message(XClientMessageEvent &event);
+
+        // The window starts out unmapped
+        void show();
+
+        // Unmaps the window and keeps everything else, so it can be shown again
+        void hide();
+
+        // Starts a new session in `path`, an absolute path, and shows the window.
+        // The directory caches are kept from the last session.
+        void open(const char * const path);
+
+        // Where 'c' asked to go, once the event handlers have returned USER_CD_EXIT_CODE
+        const char * get_cd_target() const;
+
+        // Called when the loader's fd is readable
+        int on_load_progress();
+
+        int load_fd() const;
+
+        // Called when the cache's inotify fd is readable
+        int on_cache_event();
+
+        int cache_fd() const;
+
+        // Called when the search's fd is readable
+        int on_search_progress();
+
+        int search_fd() const;
+
+        // Called when the sizer's fd is readable
+        int on_size_progress();
+
+        int size_fd() const;
+
+        // Called when the prefetcher's fd is readable
+        int on_prefetch_progress();
+
+        int prefetch_fd() const;
+
+        // Called after every wakeup of the event loop, to run anything that was
+        // waiting on a timeout
+        int on_timer();
+
+        // Returns the number of milliseconds until `on_timer` has work to do, or -1
+        // if it's not waiting on anything
+        int next_timeout() const;
+
         ~window_context();
 
     private:
         int screen;
         Window win;
+        Atom wm_delete;
         GC gc;
         // /usr/share/X11/rgb.txt
         unsigned long black;
@@ -71,50 +173,163 @@ class window_context {
         unsigned long hover_color;
         unsigned long no_perm_color;
         unsigned long status_color;
-        XWindowAttributes window_attrs;
-        // https://insanecoding.blogspot.com/2007/11/pathmax-simply-isnt.html
-        // I am using PATH_MAX anyway. If you have a path longer than PATH_MAX, you have bigger problems
-        // than a buffer overflow in a silly file explorer
-        char cwd[PATH_MAX + 1];
-        size_t cwd_len;
-        DIR * dir;
-        path_segment children[MAX_CHILDREN];
+        int win_width;
+        int win_height;
+        // True while the window is mapped
+        bool shown;
+        startup_stats startup;
+        // The current directory and what's shown of it
+        dir_model model;
+        // True if the statusline is showing load progress and should be cleared
+        // once the load is done
+        bool showing_progress;
+        // Whether keys are commands or are being typed into the filter or search
+        unsigned char prompt;
+        // What was typed after '/'
+        char filter_text[NAME_MAX + 1];
+        size_t filter_len;
+        // What was typed after 'f'
+        char search_text[NAME_MAX + 1];
+        size_t search_len;
+        char cd_target[PATH_MAX + 1];
+        // Which entries are on screen, and where. Entry numbers are positions among
+        // what the model shows.
+        list_view view;
+        // Directories that were left, for back and forward
+        nav_history history;
+        // Row to scroll to once the current directory is loaded, for a directory
+        // that was scrolled somewhere when it was left but isn't cached anymore
+        size_t pending_top;
         int mouse_y;
-        int max_y;
-        bool can_scroll;
-        int scrollrow;
-        int max_scrollrow;
+        // The entry the mouse has been on since `dwell_since_ns`, or SIZE_MAX. Once
+        // it's been there for PREFETCH_DWELL_MS, it and its neighbours are prefetched.
+        size_t dwell_entry;
+        long long dwell_since_ns;
+        bool dwell_pending;
         bool debug_enabled;
-        struct stat tmp_stat;
-        char tmp_path[PATH_MAX + 1];
-        size_t tmp_path_len;
-        unsigned int uid;
-        unsigned int gid;
         // 256 for message text + 256 max filename size in case I want to write
         // filenames here
         char status[512];
         size_t status_len;
-        Pixmap back_buffer;
+        // Where frames are drawn before they're copied to the window
+        canvas * back_buffer;
         int max_area;
         bool show_help;
+        // Horizontal bands of the window that are out of date, as [top, bottom)
+        int damage_top[MAX_DAMAGE];
+        int damage_bottom[MAX_DAMAGE];
+        size_t num_damage;
+        // Row on screen that is drawn with the hover highlight, or -1
+        int hover_row;
+        // Wheel clicks that haven't been scrolled yet, positive for down
+        int pending_scroll;
+        // True if the whole window has to be drawn again
+        bool needs_redraw;
+        long long last_frame_ns;
+        // Time spent drawing each frame, and the number of X requests it made. These
+        // are only collected in debug mode or when FX_PERF_LOG is set.
+        perf_histogram frame_times;
+        unsigned long last_frame_requests;
+        unsigned long long total_frame_requests;
+        // Where to write the timings on exit: a path, "-" for stderr, or null
+        const char * perf_log;
 
-        void read_child_dirs(int start_at);
+        // Asks for the metadata of the rows on screen, then the rows a screen above
+        // and below them
+        void request_visible_stats();
 
+        // Repaints the whole window
         void redraw();
+
+        // Draws a frame if anything has changed. The event handlers only record
+        // what changed, so this is the only place that draws.
+        void render();
+
+        void draw_frame();
+
+        // Draws the timings for the last frame and navigation over the list
+        void draw_perf_overlay();
+
+        void dump_perf(FILE * out);
+
+        // Does the setup that waits on the server but isn't needed to draw, once the
+        // first frame is out
+        void finish_setup();
+
+        int format_startup(char * const buf, size_t buf_size) const;
+
+        int live_update_timeout() const;
+        int frame_timeout() const;
+        int prefetch_timeout() const;
+        bool has_frame_work() const;
         void draw_help();
 
-        void draw_filetype(int y, unsigned int mode);
+        // Marks part of the window as out of date. Nothing is drawn until `repaint`.
+        void damage(int top, int bottom);
+        void damage_row(int screen_row);
+        void damage_status();
+
+        // Draws the out of date parts of the window into the back buffer and copies
+        // only those parts to the window
+        void repaint();
+
+        // Draws everything that overlaps the band [top, bottom) into the back buffer,
+        // clipped to the band
+        void paint(int top, int bottom);
+
+        // Tells the view how many entries there are and how much room they have
+        void update_layout();
+
+        // Handles a key while the filter or search is being typed
+        void on_prompt_key(XKeyEvent &event);
+
+        void clear_filter();
+        void show_filter_status();
+
+        void start_search();
+        void stop_search();
+        void show_search_status();
+
+        // Scrolls by `delta` rows. The rows that stay on screen are moved inside the
+        // back buffer, and only the rows that come into view are drawn.
+        void scroll_by(int delta);
+
+        // Draws 'd' or 'f' for an entry with ENTRY_* flags `flags`
+        void draw_filetype(int y, uint8_t flags);
+
+        // Draws the size of the entry with load order index `index` in the model's
+        // listing, if it's known
+        void draw_size(int y, uint32_t index);
+
+        // Sets `row` to the row of the shown listing under the mouse. Returns false if
+        // there isn't one.
+        bool get_selected_row(size_t * row);
+
+        // Moves into `name`, relative to the current directory. The name is copied
+        // before anything else happens, so it can point into the listing.
+        void navigate(const char * const name, size_t len);
+
+        // Resets the view after the model has moved to another directory, scrolled so
+        // that listing row `top` is at the top of the screen
+        void navigated(size_t top);
+
+        // Goes back to the last directory that was left, or forward again if
+        // `forward` is set
+        void go_back(bool forward);
 
-        path_segment * get_selected_segment();
+        // The listing row at the top of the screen, to be restored when coming back
+        // to the directory. Search results aren't kept, so this is 0 while searching.
+        size_t top_row() const;
 
-        void path_join(char * const wd, size_t * wd_len, path_segment &path);
+        // Starts timing how long the mouse stays on the entry under it, if that's a
+        // different entry than before or `restart` is set
+        void track_dwell(bool restart);
 
-        void navigate(path_segment &path);
+        void show_cache_stats();
 
-        // If `path` is a directory, returns true if the current user
-        // has execute permissions. Otherwise returns true if the current
-        // user has read permissions.
-        bool has_permission(path_segment &path);
+        // Applies the queued changes to the current directory, keeping the same
+        // entry at the top of the screen
+        void apply_live_changes();
 
         void set_status(const char * const text);
 
@@ -0,0 +1,585 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include "../include/canvas.h"
+#include "../include/util.h"
+
+canvas::~canvas() {}
+
+void canvas::begin() {}
+
+void canvas::flush() {}
+
+void canvas::on_event(XEvent &event) {}
+
+unsigned int canvas::finish_setup() {
+    return 0;
+}
+
+server_canvas::server_canvas(Display * dis, Window win, GC gc, int width, int height) {
+    this->dis = dis;
+    this->win = win;
+    this->gc = gc;
+    this->width = width;
+    this->height = height;
+    this->buffer = XCreatePixmap(dis, win, width, height, 24);
+    // What XCreateGC starts with
+    this->color = 0;
+}
+
+server_canvas::~server_canvas() {
+    XFreePixmap(this->dis, this->buffer);
+}
+
+void server_canvas::resize(int width, int height) {
+    XFreePixmap(this->dis, this->buffer);
+    this->buffer = XCreatePixmap(this->dis, this->win, width, height, 24);
+    this->width = width;
+    this->height = height;
+}
+
+void server_canvas::set_color(unsigned long pixel) {
+    if (pixel != this->color) {
+        XSetForeground(this->dis, this->gc, pixel);
+        this->color = pixel;
+    }
+}
+
+void server_canvas::fill_rect(int x, int y, int width, int height) {
+    XFillRectangle(this->dis, this->buffer, this->gc, x, y, width, height);
+}
+
+void server_canvas::draw_rect(int x, int y, int width, int height) {
+    XDrawRectangle(this->dis, this->buffer, this->gc, x, y, width, height);
+}
+
+void server_canvas::draw_hline(int x1, int x2, int y) {
+    XDrawLine(this->dis, this->buffer, this->gc, x1, y, x2, y);
+}
+
+void server_canvas::draw_string(int x, int baseline, const char * const str, size_t len) {
+    XDrawString(this->dis, this->buffer, this->gc, x, baseline, str, len);
+}
+
+void server_canvas::set_clip(int top, int bottom) {
+    XRectangle band = { 0, (short) top, (unsigned short) this->width, (unsigned short) (bottom - top) };
+    XSetClipRectangles(this->dis, this->gc, 0, 0, &band, 1, Unsorted);
+}
+
+void server_canvas::clear_clip() {
+    XSetClipMask(this->dis, this->gc, None);
+}
+
+void server_canvas::copy_rows(int src_y, int dst_y, int width, int height) {
+    XCopyArea(this->dis, this->buffer, this->buffer, this->gc, 0, src_y, width, height, 0, dst_y);
+}
+
+void server_canvas::present(int x, int y, int width, int height) {
+    XCopyArea(this->dis, this->buffer, this->win, this->gc, x, y, width, height, x, y);
+}
+
+const char * server_canvas::name() const {
+    return "server";
+}
+
+image_canvas::image_canvas(Display * dis, Window win, GC gc) {
+    this->dis = dis;
+    this->win = win;
+    this->gc = gc;
+    this->visual = DefaultVisual(dis, DefaultScreen(dis));
+    this->depth = DefaultDepth(dis, DefaultScreen(dis));
+    this->image = nullptr;
+    this->use_shm = false;
+    this->completion_type = -1;
+    this->shm_busy = false;
+    this->swap_bytes = false;
+    this->color = 0;
+    this->clip_top = 0;
+    this->clip_bottom = 0;
+    this->num_presents = 0;
+}
+
+image_canvas * image_canvas::create(Display * dis, Window win, GC gc, int width, int height, unsigned int &round_trips) {
+    if (DefaultVisual(dis, DefaultScreen(dis))->c_class != TrueColor) {
+        return nullptr;
+    }
+
+    image_canvas * out = new image_canvas(dis, win, gc);
+
+    if (! out->create_image(width, height) || ! out->build_atlas(round_trips)) {
+        delete out;
+
+        return nullptr;
+    }
+
+    out->clip_bottom = out->image->height;
+    // Pixels are written as native integers
+    out->swap_bytes = (out->image->byte_order == MSBFirst) != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+
+    return out;
+}
+
+image_canvas::~image_canvas() {
+    this->destroy_image();
+}
+
+bool image_canvas::create_image(int width, int height) {
+    if (this->use_shm && this->attach_shm(width, height)) {
+        return true;
+    }
+
+    // e.g. a bigger window ran into the system's limit on segment size
+    this->use_shm = false;
+    this->image = XCreateImage(this->dis, this->visual, this->depth, ZPixmap, 0, nullptr, width, height, 32, 0);
+
+    if (! this->image) {
+        return false;
+    }
+
+    if (this->image->bits_per_pixel != 32) {
+        XDestroyImage(this->image);
+        this->image = nullptr;
+
+        return false;
+    }
+
+    this->image->data = (char *) malloc(this->image->bytes_per_line * height);
+    check_error(this->image->data, (char *) NULL);
+
+    return true;
+}
+
+bool image_canvas::attach_shm(int width, int height) {
+    this->image = XShmCreateImage(this->dis, this->visual, this->depth, ZPixmap, nullptr, &this->shm, width, height);
+
+    if (! this->image) {
+        return false;
+    }
+
+    this->shm.shmid = shmget(IPC_PRIVATE, this->image->bytes_per_line * height, IPC_CREAT | 0600);
+
+    if (this->image->bits_per_pixel != 32 || this->shm.shmid == -1) {
+        XDestroyImage(this->image);
+        this->image = nullptr;
+
+        return false;
+    }
+
+    void * const addr = shmat(this->shm.shmid, nullptr, 0);
+
+    if (addr == (void *) -1) {
+        shmctl(this->shm.shmid, IPC_RMID, nullptr);
+        XDestroyImage(this->image);
+        this->image = nullptr;
+
+        return false;
+    }
+
+    this->shm.shmaddr = this->image->data = (char *) addr;
+    this->shm.readOnly = False;
+    XShmAttach(this->dis, &this->shm);
+
+    // The segment goes away once both sides have detached, even if fx crashes. Linux
+    // still lets the server attach after this.
+    shmctl(this->shm.shmid, IPC_RMID, nullptr);
+
+    return true;
+}
+
+void image_canvas::destroy_image() {
+    if (! this->image) {
+        return;
+    }
+
+    this->wait_for_server();
+
+    if (this->use_shm) {
+        XShmDetach(this->dis, &this->shm);
+        shmdt(this->shm.shmaddr);
+        this->image->data = nullptr;
+    }
+
+    XDestroyImage(this->image);
+    this->image = nullptr;
+}
+
+// Draws every byte value with the server's font and reads the result back, so
+// text looks exactly like it does when the server draws it
+bool image_canvas::build_atlas(unsigned int &round_trips) {
+    XFontStruct * font = XQueryFont(this->dis, XGContextFromGC(this->gc));
+    round_trips++;
+
+    if (! font) {
+        return false;
+    }
+
+    glyph_atlas &atlas = this->atlas;
+
+    atlas.cell_width = font->max_bounds.rbearing - font->min_bounds.lbearing;
+    atlas.cell_height = font->max_bounds.ascent + font->max_bounds.descent;
+    atlas.origin_x = -font->min_bounds.lbearing;
+    atlas.ascent = font->max_bounds.ascent;
+
+    if (atlas.cell_width <= 0 || atlas.cell_width > 255 || atlas.cell_height <= 0) {
+        XFreeFontInfo(nullptr, font, 1);
+
+        return false;
+    }
+
+    for (int c = 0; c < 256; c++) {
+        const char ch = c;
+
+        // Handles characters the font doesn't have the same way the server does
+        atlas.advance[c] = XTextWidth(font, &ch, 1);
+    }
+
+    XFreeFontInfo(nullptr, font, 1);
+
+    const int atlas_width = 256 * atlas.cell_width;
+    Pixmap pixmap = XCreatePixmap(this->dis, this->win, atlas_width, atlas.cell_height, this->depth);
+    // A new GC has the same default font as the window's
+    GC atlas_gc = XCreateGC(this->dis, pixmap, 0, nullptr);
+
+    XSetForeground(this->dis, atlas_gc, 0);
+    XFillRectangle(this->dis, pixmap, atlas_gc, 0, 0, atlas_width, atlas.cell_height);
+    XSetForeground(this->dis, atlas_gc, WhitePixel(this->dis, DefaultScreen(this->dis)));
+
+    for (int c = 0; c < 256; c++) {
+        const char ch = c;
+
+        XDrawString(this->dis, pixmap, atlas_gc, c * atlas.cell_width + atlas.origin_x, atlas.ascent, &ch, 1);
+    }
+
+    XImage * glyphs = XGetImage(this->dis, pixmap, 0, 0, atlas_width, atlas.cell_height, AllPlanes, ZPixmap);
+    round_trips++;
+
+    XFreeGC(this->dis, atlas_gc);
+    XFreePixmap(this->dis, pixmap);
+
+    if (! glyphs) {
+        return false;
+    }
+
+    atlas.mask.resize(atlas_width * atlas.cell_height);
+
+    for (int c = 0; c < 256; c++) {
+        int left = atlas.cell_width;
+        int right = 0;
+
+        for (int y = 0; y < atlas.cell_height; y++) {
+            for (int x = 0; x < atlas.cell_width; x++) {
+                const int atlas_x = c * atlas.cell_width + x;
+                const bool set = XGetPixel(glyphs, atlas_x, y) != 0;
+
+                atlas.mask[y * atlas_width + atlas_x] = set;
+
+                if (set) {
+                    left = std::min(left, x);
+                    right = std::max(right, x + 1);
+                }
+            }
+        }
+
+        atlas.ink_left[c] = left < right ? left : 0;
+        atlas.ink_right[c] = left < right ? right : 0;
+    }
+
+    XDestroyImage(glyphs);
+
+    return true;
+}
+
+void image_canvas::resize(int width, int height) {
+    this->destroy_image();
+
+    if (! this->create_image(width, height)) {
+        // The first image could be made with these settings, so a bigger one only
+        // fails if we're out of memory
+        throw ENOMEM;
+    }
+
+    this->clip_top = 0;
+    this->clip_bottom = height;
+    this->num_presents = 0;
+}
+
+static Bool is_shm_completion(Display * dis, XEvent * event, XPointer arg) {
+    return event->type == *(int *) arg;
+}
+
+void image_canvas::wait_for_server() {
+    if (! this->shm_busy) {
+        return;
+    }
+
+    XEvent event;
+
+    // Anything else that arrives in the meantime stays queued for the event loop
+    XIfEvent(this->dis, &event, is_shm_completion, (XPointer) &this->completion_type);
+    this->shm_busy = false;
+}
+
+void image_canvas::begin() {
+    // The server might still be reading the last frame out of shared memory
+    this->wait_for_server();
+}
+
+void image_canvas::on_event(XEvent &event) {
+    if (event.type == this->completion_type) {
+        this->shm_busy = false;
+    }
+}
+
+void image_canvas::set_color(unsigned long pixel) {
+    this->color = this->swap_bytes ? __builtin_bswap32((uint32_t) pixel) : (uint32_t) pixel;
+}
+
+bool image_canvas::clip(int &x, int &y, int &width, int &height) const {
+    const int left = std::max(x, 0);
+    const int right = std::min(x + width, this->image->width);
+    const int top = std::max(y, this->clip_top);
+    const int bottom = std::min({ y + height, this->clip_bottom, this->image->height });
+
+    x = left;
+    y = top;
+    width = right - left;
+    height = bottom - top;
+
+    return width > 0 && height > 0;
+}
+
+void image_canvas::fill_rect(int x, int y, int width, int height) {
+    if (! this->clip(x, y, width, height)) {
+        return;
+    }
+
+    for (int row = y; row < y + height; row++) {
+        uint32_t * const pixels = (uint32_t *) (this->image->data + row * this->image->bytes_per_line) + x;
+
+        std::fill(pixels, pixels + width, this->color);
+    }
+}
+
+void image_canvas::draw_rect(int x, int y, int width, int height) {
+    this->fill_rect(x, y, width + 1, 1);
+    this->fill_rect(x, y + height, width + 1, 1);
+    this->fill_rect(x, y, 1, height + 1);
+    this->fill_rect(x + width, y, 1, height + 1);
+}
+
+void image_canvas::draw_hline(int x1, int x2, int y) {
+    const int left = std::min(x1, x2);
+
+    this->fill_rect(left, y, std::max(x1, x2) - left + 1, 1);
+}
+
+void image_canvas::draw_string(int x, int baseline, const char * const str, size_t len) {
+    const glyph_atlas &atlas = this->atlas;
+    const int atlas_width = 256 * atlas.cell_width;
+    const int top = baseline - atlas.ascent;
+    const int first_row = std::max(0, this->clip_top - top);
+    const int last_row = std::min(atlas.cell_height, std::min(this->clip_bottom, this->image->height) - top);
+    int pen = x;
+
+    for (size_t i = 0; i < len && pen < this->image->width; i++) {
+        const unsigned char c = str[i];
+        const int cell_x = pen - atlas.origin_x;
+        const int left = std::max((int) atlas.ink_left[c], -cell_x);
+        const int right = std::min((int) atlas.ink_right[c], this->image->width - cell_x);
+
+        for (int row = first_row; row < last_row; row++) {
+            const unsigned char * const mask = &atlas.mask[row * atlas_width + c * atlas.cell_width];
+            uint32_t * const pixels = (uint32_t *) (this->image->data + (top + row) * this->image->bytes_per_line) + cell_x;
+
+            for (int col = left; col < right; col++) {
+                if (mask[col]) {
+                    pixels[col] = this->color;
+                }
+            }
+        }
+
+        pen += atlas.advance[c];
+    }
+}
+
+void image_canvas::set_clip(int top, int bottom) {
+    this->clip_top = top;
+    this->clip_bottom = bottom;
+}
+
+void image_canvas::clear_clip() {
+    this->clip_top = 0;
+    this->clip_bottom = this->image->height;
+}
+
+void image_canvas::copy_rows(int src_y, int dst_y, int width, int height) {
+    const int bytes_per_line = this->image->bytes_per_line;
+    const size_t row_bytes = std::min(width, this->image->width) * sizeof(uint32_t);
+
+    height = std::min({ height, this->image->height - src_y, this->image->height - dst_y });
+
+    // Rows are copied in the order that doesn't overwrite rows still to be copied
+    for (int i = 0; i < height; i++) {
+        const int row = dst_y > src_y ? height - 1 - i : i;
+
+        memmove(
+            this->image->data + (dst_y + row) * bytes_per_line,
+            this->image->data + (src_y + row) * bytes_per_line,
+            row_bytes
+        );
+    }
+}
+
+void image_canvas::present(int x, int y, int width, int height) {
+    const int right = std::min(x + width, this->image->width);
+    const int bottom = std::min(y + height, this->image->height);
+
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    width = right - x;
+    height = bottom - y;
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    if (this->num_presents == MAX_PRESENTS) {
+        // Too many to send one by one, so send the rectangle around all of them
+        for (size_t i = 1; i < this->num_presents; i++) {
+            int * const first = this->presents[0];
+            const int * const other = this->presents[i];
+            const int right = std::max(first[0] + first[2], other[0] + other[2]);
+            const int bottom = std::max(first[1] + first[3], other[1] + other[3]);
+
+            first[0] = std::min(first[0], other[0]);
+            first[1] = std::min(first[1], other[1]);
+            first[2] = right - first[0];
+            first[3] = bottom - first[1];
+        }
+
+        this->num_presents = 1;
+    }
+
+    int * const rect = this->presents[this->num_presents++];
+
+    rect[0] = x;
+    rect[1] = y;
+    rect[2] = width;
+    rect[3] = height;
+}
+
+void image_canvas::flush() {
+    if (this->num_presents == 0) {
+        return;
+    }
+
+    if (! this->use_shm) {
+        for (size_t i = 0; i < this->num_presents; i++) {
+            const int * const rect = this->presents[i];
+
+            XPutImage(this->dis, this->win, this->gc, this->image, rect[0], rect[1], rect[0], rect[1], rect[2], rect[3]);
+        }
+
+        this->num_presents = 0;
+
+        return;
+    }
+
+    // With shared memory nothing is copied over the connection, so one request for
+    // everything costs less than one per rectangle
+    int left = this->presents[0][0];
+    int top = this->presents[0][1];
+    int right = left + this->presents[0][2];
+    int bottom = top + this->presents[0][3];
+
+    for (size_t i = 1; i < this->num_presents; i++) {
+        const int * const rect = this->presents[i];
+
+        left = std::min(left, rect[0]);
+        top = std::min(top, rect[1]);
+        right = std::max(right, rect[0] + rect[2]);
+        bottom = std::max(bottom, rect[1] + rect[3]);
+    }
+
+    XShmPutImage(this->dis, this->win, this->gc, this->image, left, top, left, top, right - left, bottom - top, True);
+    this->shm_busy = true;
+    this->num_presents = 0;
+}
+
+static bool shm_failed = false;
+
+static int on_shm_error(Display * dis, XErrorEvent * error) {
+    shm_failed = true;
+
+    return 0;
+}
+
+unsigned int image_canvas::finish_setup() {
+    const char * const display = DisplayString(this->dis);
+
+    // A remote server can't see our memory. It might even have an unrelated
+    // segment with the same id.
+    if (display[0] != ':' && strncmp(display, "unix:", 5) != 0) {
+        return 0;
+    }
+
+    if (! XShmQueryExtension(this->dis)) {
+        return 1;
+    }
+
+    const int width = this->image->width;
+    const int height = this->image->height;
+    XImage * const plain = this->image;
+
+    // Errors from the attach are caught here instead of ending the program
+    shm_failed = false;
+    XErrorHandler old_handler = XSetErrorHandler(on_shm_error);
+    const bool attached = this->attach_shm(width, height);
+    XSync(this->dis, False);
+    XSetErrorHandler(old_handler);
+
+    if (attached && ! shm_failed) {
+        // The buffer's contents are still needed to scroll
+        for (int y = 0; y < height; y++) {
+            memcpy(this->image->data + y * this->image->bytes_per_line, plain->data + y * plain->bytes_per_line, width * sizeof(uint32_t));
+        }
+
+        XDestroyImage(plain);
+        this->use_shm = true;
+        this->completion_type = XShmGetEventBase(this->dis) + ShmCompletion;
+    } else {
+        if (attached) {
+            shmdt(this->shm.shmaddr);
+            this->image->data = nullptr;
+            XDestroyImage(this->image);
+        }
+
+        this->image = plain;
+    }
+
+    return 2;
+}
+
+const char * image_canvas::name() const {
+    return this->use_shm ? "client, shm" : "client";
+}
@@ -0,0 +1,392 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/dir_cache.h"
+#include "../include/perf_stats.h"
+#include "../include/util.h"
+
+// Anything that would change what fx shows for a directory
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// Events after which an entry exists, or doesn't
+const uint32_t ADDED_MASK = IN_CREATE | IN_MOVED_TO;
+const uint32_t REMOVED_MASK = IN_DELETE | IN_MOVED_FROM;
+// Events that mean the watched directory itself is gone, or that we missed something
+const uint32_t LOST_MASK = IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW;
+
+dir_cache::dir_cache(size_t budget) {
+    this->hits = 0;
+    this->misses = 0;
+    this->invalidations = 0;
+    this->budget = budget;
+    this->num_slots = 0;
+    this->used_bytes = 0;
+    this->clock = 0;
+    this->current_path[0] = '\0';
+    this->current_wd = -1;
+    this->current_valid = false;
+    this->prefetch_path[0] = '\0';
+    this->prefetch_wd = -1;
+    this->prefetch_valid = false;
+    this->first_change_ns = 0;
+    this->spare = nullptr;
+
+    this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    check_error(this->inotify_fd, -1);
+}
+
+dir_cache::~dir_cache() {
+    for (size_t i = 0; i < this->num_slots; i++) {
+        free(this->slots[i].path);
+        delete this->slots[i].listing;
+    }
+
+    delete this->spare;
+    close(this->inotify_fd);
+}
+
+bool dir_cache::enter(const char * const path, dir_listing &listing) {
+    size_t len = strlen(path);
+
+    memcpy(this->current_path, path, len + 1);
+    this->changes.clear();
+    this->change_masks.clear();
+
+    for (size_t i = 0; i < this->num_slots; i++) {
+        cache_slot &slot = this->slots[i];
+
+        if (strcmp(slot.path, path) != 0) {
+            continue;
+        }
+
+        this->hits++;
+        this->current_wd = slot.wd;
+        this->current_valid = true;
+
+        // Hand the slot's watch over to the current directory before evicting it,
+        // so that it isn't removed
+        slot.wd = -1;
+        listing.swap(*slot.listing);
+        this->evict(i);
+
+        return true;
+    }
+
+    this->misses++;
+    this->current_wd = inotify_add_watch(this->inotify_fd, path, WATCH_MASK);
+    // If we can't watch it (e.g. we've hit max_user_watches), we just won't cache it
+    this->current_valid = this->current_wd != -1;
+
+    return false;
+}
+
+void dir_cache::leave(dir_listing &listing, bool complete) {
+    if (! complete || ! this->current_valid || this->has_changes()) {
+        this->release_watch(this->current_wd);
+        this->current_wd = -1;
+        listing.clear();
+
+        return;
+    }
+
+    const int wd = this->current_wd;
+
+    // The watch stays marked as the current directory's until the slot holds it,
+    // so evictions on the way don't remove it. If the listing was too big to keep,
+    // the watch goes too.
+    this->insert(this->current_path, wd, listing);
+    this->current_wd = -1;
+    this->release_watch(wd);
+}
+
+bool dir_cache::contains(const char * const path) const {
+    if (strcmp(this->current_path, path) == 0) {
+        return true;
+    }
+
+    for (size_t i = 0; i < this->num_slots; i++) {
+        if (strcmp(this->slots[i].path, path) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool dir_cache::begin_prefetch(const char * const path) {
+    this->cancel_prefetch();
+
+    int wd = inotify_add_watch(this->inotify_fd, path, WATCH_MASK);
+
+    if (wd == -1) {
+        return false;
+    }
+
+    memcpy(this->prefetch_path, path, strlen(path) + 1);
+    this->prefetch_wd = wd;
+    this->prefetch_valid = true;
+
+    return true;
+}
+
+void dir_cache::finish_prefetch(dir_listing &listing) {
+    if (this->prefetch_wd == -1 || ! this->prefetch_valid) {
+        this->cancel_prefetch();
+        listing.clear();
+
+        return;
+    }
+
+    const int wd = this->prefetch_wd;
+
+    // Like in `leave`
+    this->insert(this->prefetch_path, wd, listing);
+    this->prefetch_wd = -1;
+    this->release_watch(wd);
+}
+
+void dir_cache::cancel_prefetch() {
+    const int wd = this->prefetch_wd;
+
+    this->prefetch_wd = -1;
+    this->release_watch(wd);
+}
+
+void dir_cache::insert(const char * const path, int wd, dir_listing &listing) {
+    if (this->num_slots == DIR_CACHE_MAX_ENTRIES) {
+        size_t oldest = 0;
+
+        for (size_t i = 1; i < this->num_slots; i++) {
+            if (this->slots[i].last_used < this->slots[oldest].last_used) {
+                oldest = i;
+            }
+        }
+
+        this->evict(oldest);
+    }
+
+    cache_slot &slot = this->slots[this->num_slots++];
+
+    slot.path = strdup(path);
+    check_error(slot.path, (char *) nullptr);
+    slot.wd = wd;
+    slot.last_used = ++this->clock;
+
+    if (this->spare) {
+        slot.listing = this->spare;
+        this->spare = nullptr;
+    } else {
+        slot.listing = new dir_listing();
+    }
+
+    slot.listing->swap(listing);
+    slot.listing->forget_requests();
+    slot.listing->compact();
+    listing.clear();
+
+    slot.bytes = slot.listing->memory_usage();
+    this->used_bytes += slot.bytes;
+
+    while (this->used_bytes > this->budget && this->num_slots > 0) {
+        size_t oldest = 0;
+
+        for (size_t i = 1; i < this->num_slots; i++) {
+            if (this->slots[i].last_used < this->slots[oldest].last_used) {
+                oldest = i;
+            }
+        }
+
+        this->evict(oldest);
+    }
+}
+
+void dir_cache::on_inotify() {
+    // Big enough for several events with maximum length names
+    alignas(struct inotify_event) char buf[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+    while (1) {
+        ssize_t bytes = read(this->inotify_fd, buf, sizeof(buf));
+
+        if (bytes <= 0) {
+            return;
+        }
+
+        for (ssize_t pos = 0; pos < bytes; ) {
+            const struct inotify_event * event = (const struct inotify_event *) (buf + pos);
+            // If the queue overflowed we don't know what changed, so assume everything did
+            const bool all = event->mask & IN_Q_OVERFLOW;
+
+            if (all || event->wd == this->prefetch_wd) {
+                this->prefetch_valid = false;
+            }
+
+            if (all || (event->wd == this->current_wd && (event->mask & LOST_MASK))) {
+                this->current_valid = false;
+            } else if (event->wd == this->current_wd) {
+                if (! this->has_changes()) {
+                    this->first_change_ns = perf_now_ns();
+                }
+
+                // An empty name means the event is about the directory itself
+                if (event->len == 0) {
+                    this->changes.add(".", 1);
+                } else {
+                    this->changes.add(event->name, strlen(event->name));
+                }
+
+                this->change_masks.push_back(event->mask);
+            }
+
+            for (size_t i = 0; i < this->num_slots; ) {
+                if (all || this->slots[i].wd == event->wd) {
+                    this->invalidations++;
+                    this->evict(i);
+                } else {
+                    i++;
+                }
+            }
+
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+bool dir_cache::has_changes() const {
+    return this->changes.size() != 0;
+}
+
+unsigned long long dir_cache::changes_since() const {
+    return this->first_change_ns;
+}
+
+bool dir_cache::current_up_to_date() const {
+    return this->current_valid;
+}
+
+void dir_cache::apply_changes(dir_listing &listing) {
+    // Several events for the same name collapse into one change: the entry
+    // ends up existing or not depending on the last event that created or removed
+    // it. Sorting the changes brings events for the same name together; within
+    // a group, the load order index tells us which event came last.
+    this->changes.sort();
+
+    size_t first_new = listing.size();
+    bool any_removed = false;
+    size_t group_start = 0;
+
+    while (group_start < this->changes.size()) {
+        const path_segment &first = this->changes.at(group_start);
+        const char * const name = this->changes.name(first);
+        size_t group_end = group_start + 1;
+        // Index of the last event that added or removed the entry, if there was one
+        uint32_t last = UINT32_MAX;
+
+        while (group_end < this->changes.size() && name_cmp(this->changes.name(this->changes.at(group_end)), this->changes.at(group_end).len, name, first.len) == 0) {
+            group_end++;
+        }
+
+        for (size_t row = group_start; row < group_end; row++) {
+            uint32_t index = this->changes.index_at(row);
+
+            if ((this->change_masks[index] & (ADDED_MASK | REMOVED_MASK)) && (last == UINT32_MAX || index > last)) {
+                last = index;
+            }
+        }
+
+        size_t row;
+        bool exists = listing.find(name, first.len, &row, first_new);
+
+        if (last != UINT32_MAX && (this->change_masks[last] & REMOVED_MASK)) {
+            if (exists) {
+                listing.remove(row);
+                any_removed = true;
+            }
+        } else if (exists) {
+            listing.at(row).meta = META_NONE;
+        } else if (last != UINT32_MAX) {
+            listing.add(name, first.len, (this->change_masks[last] & IN_ISDIR) ? S_IFDIR : S_IFREG);
+        }
+
+        group_start = group_end;
+    }
+
+    // Removals and additions are for different names, so it doesn't matter that
+    // the removed rows are still in the sorted order while new ones go in
+    listing.insert_from(first_new);
+
+    if (any_removed) {
+        listing.remove_marked();
+    }
+
+    this->changes.clear();
+    this->change_masks.clear();
+}
+
+int dir_cache::fd() const {
+    return this->inotify_fd;
+}
+
+size_t dir_cache::size() const {
+    return this->num_slots;
+}
+
+size_t dir_cache::memory_usage() const {
+    return this->used_bytes;
+}
+
+void dir_cache::evict(size_t slot) {
+    cache_slot &victim = this->slots[slot];
+    int wd = victim.wd;
+
+    this->used_bytes -= victim.bytes;
+    free(victim.path);
+
+    // Keep the biggest listing around as the spare; it's the one most likely to fit
+    // the next directory without growing
+    if (! this->spare) {
+        this->spare = victim.listing;
+    } else if (victim.listing->memory_usage() > this->spare->memory_usage()) {
+        delete this->spare;
+        this->spare = victim.listing;
+    } else {
+        delete victim.listing;
+    }
+
+    this->slots[slot] = this->slots[--this->num_slots];
+    this->release_watch(wd);
+}
+
+void dir_cache::release_watch(int wd) {
+    if (wd == -1 || wd == this->current_wd || wd == this->prefetch_wd) {
+        return;
+    }
+
+    // Two paths can lead to the same directory, and inotify gives them the same watch
+    for (size_t i = 0; i < this->num_slots; i++) {
+        if (this->slots[i].wd == wd) {
+            return;
+        }
+    }
+
+    // This fails if the watch was already removed because the directory was deleted,
+    // which is fine
+    inotify_rm_watch(this->inotify_fd, wd);
+}
@@ -0,0 +1,432 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/dir_listing.h"
+#include "../include/name_sort.h"
+#include "../include/util.h"
+
+// Batches of new entries bigger than this are sorted and merged in by `insert_from`
+// rather than inserted one by one
+const size_t INSERT_SORT_MAX = 32;
+
+// Initial capacities. These are small because most directories are small; the
+// listing doubles as needed and never shrinks.
+const size_t INITIAL_ENTRIES_CAP = 64;
+const size_t INITIAL_NAMES_CAP = 4096;
+
+// Who permissions are checked for. These can't change while fx is running.
+static const unsigned int USER_UID = getuid();
+static const unsigned int USER_GID = getgid();
+
+// Directories need execute permission to be entered; everything else needs read
+// permission to be opened
+static bool is_permitted(unsigned int mode, unsigned int uid, unsigned int gid) {
+    if (S_ISDIR(mode)) {
+        return (S_IXOTH & mode) || ((S_IXUSR & mode) && USER_UID == uid) || ((S_IXGRP & mode) && USER_GID == gid);
+    }
+
+    return (S_IROTH & mode) || ((S_IRUSR & mode) && USER_UID == uid) || ((S_IRGRP & mode) && USER_GID == gid);
+}
+
+static int entry_cmp(const char * const names, const path_segment &a, const path_segment &b) {
+    return name_cmp(names + a.name_offset, a.len, names + b.name_offset, b.len);
+}
+
+dir_listing::dir_listing() {
+    this->names = nullptr;
+    this->names_len = 0;
+    this->names_cap = 0;
+    this->entries = nullptr;
+    this->entry_flags = nullptr;
+    this->order = nullptr;
+    this->merge_buf = nullptr;
+    this->keys = nullptr;
+    this->count = 0;
+    this->num_rows = 0;
+    this->cap = 0;
+
+    this->reserve_names(INITIAL_NAMES_CAP);
+    this->reserve_entries(INITIAL_ENTRIES_CAP);
+}
+
+dir_listing::~dir_listing() {
+    free(this->names);
+    free(this->entries);
+    free(this->entry_flags);
+    free(this->order);
+    free(this->merge_buf);
+    free(this->keys);
+}
+
+void dir_listing::clear() {
+    this->names_len = 0;
+    this->count = 0;
+    this->num_rows = 0;
+}
+
+void dir_listing::swap(dir_listing &other) {
+    char * names = this->names;
+    size_t names_len = this->names_len;
+    size_t names_cap = this->names_cap;
+    path_segment * entries = this->entries;
+    uint8_t * entry_flags = this->entry_flags;
+    uint32_t * order = this->order;
+    uint32_t * merge_buf = this->merge_buf;
+    sort_key * keys = this->keys;
+    size_t count = this->count;
+    size_t num_rows = this->num_rows;
+    size_t cap = this->cap;
+
+    this->names = other.names;
+    this->names_len = other.names_len;
+    this->names_cap = other.names_cap;
+    this->entries = other.entries;
+    this->entry_flags = other.entry_flags;
+    this->order = other.order;
+    this->merge_buf = other.merge_buf;
+    this->keys = other.keys;
+    this->count = other.count;
+    this->num_rows = other.num_rows;
+    this->cap = other.cap;
+
+    other.names = names;
+    other.names_len = names_len;
+    other.names_cap = names_cap;
+    other.entries = entries;
+    other.entry_flags = entry_flags;
+    other.order = order;
+    other.merge_buf = merge_buf;
+    other.keys = keys;
+    other.count = count;
+    other.num_rows = num_rows;
+    other.cap = cap;
+}
+
+void dir_listing::copy_from(const dir_listing &other) {
+    this->reserve_names(other.names_len);
+    this->reserve_entries(other.count);
+
+    memcpy(this->names, other.names, other.names_len);
+    memcpy(this->entries, other.entries, other.count * sizeof(path_segment));
+    memcpy(this->entry_flags, other.entry_flags, other.count * sizeof(uint8_t));
+    memcpy(this->order, other.order, other.num_rows * sizeof(uint32_t));
+
+    this->names_len = other.names_len;
+    this->count = other.count;
+    this->num_rows = other.num_rows;
+}
+
+void dir_listing::forget_requests() {
+    for (size_t i = 0; i < this->count; i++) {
+        if (this->entries[i].meta == META_REQUESTED) {
+            this->entries[i].meta = META_NONE;
+        }
+    }
+}
+
+size_t dir_listing::memory_usage() const {
+    return this->names_cap + this->cap * (sizeof(path_segment) + sizeof(uint8_t) + 2 * sizeof(uint32_t) + sizeof(sort_key));
+}
+
+path_segment &dir_listing::add(const char * const name, size_t len, unsigned int mode) {
+    if (this->names_len + len + 1 > UINT32_MAX) {
+        throw ENOMEM;
+    }
+
+    if (this->names_len + len + 1 > this->names_cap) {
+        this->reserve_names(this->names_cap * 2 > this->names_len + len + 1 ? this->names_cap * 2 : this->names_len + len + 1);
+    }
+
+    if (this->count == this->cap) {
+        this->reserve_entries(this->cap * 2);
+    }
+
+    path_segment &path = this->entries[this->count];
+
+    path.name_offset = this->names_len;
+    path.len = len;
+    path.mode = mode;
+    path.uid = 0;
+    path.gid = 0;
+    path.meta = META_NONE;
+    path.removed = false;
+
+    uint8_t flags = ENTRY_PERMITTED;
+
+    if (S_ISDIR(mode)) {
+        flags |= ENTRY_DIR;
+    } else if (S_ISLNK(mode)) {
+        flags |= ENTRY_SYMLINK;
+    }
+
+    if (len > 0 && name[0] == '.') {
+        flags |= ENTRY_HIDDEN;
+    }
+
+    this->entry_flags[this->count] = flags;
+
+    memcpy(this->names + this->names_len, name, len);
+    this->names[this->names_len + len] = '\0';
+    this->names_len += len + 1;
+
+    this->order[this->num_rows++] = this->count;
+    this->count++;
+
+    return path;
+}
+
+void dir_listing::set_meta(size_t index, unsigned int mode, unsigned int uid, unsigned int gid) {
+    path_segment &path = this->entries[index];
+    uint8_t flags = this->entry_flags[index] & (ENTRY_SYMLINK | ENTRY_HIDDEN);
+
+    path.mode = mode;
+    path.uid = uid;
+    path.gid = gid;
+    path.meta = META_DONE;
+
+    if (S_ISDIR(mode)) {
+        flags |= ENTRY_DIR;
+    }
+
+    if (is_permitted(mode, uid, gid)) {
+        flags |= ENTRY_PERMITTED;
+    }
+
+    this->entry_flags[index] = flags;
+}
+
+void dir_listing::sort() {
+    this->sort_from(0);
+}
+
+void dir_listing::sort_from(size_t start) {
+    size_t num_keys = this->num_rows - start;
+
+    for (size_t i = 0; i < num_keys; i++) {
+        const uint32_t index = this->order[start + i];
+        const path_segment &path = this->entries[index];
+
+        this->keys[i].prefix = name_prefix(this->names + path.name_offset, path.len);
+        this->keys[i].name_offset = path.name_offset;
+        this->keys[i].index = index;
+    }
+
+    sort_keys(this->keys, num_keys, this->names);
+
+    for (size_t i = 0; i < num_keys; i++) {
+        this->order[start + i] = this->keys[i].index;
+    }
+
+    if (start == 0 || start == this->num_rows) {
+        return;
+    }
+
+    size_t i = 0;
+    size_t j = start;
+    size_t k = 0;
+
+    while (i < start && j < this->num_rows) {
+        if (entry_cmp(this->names, this->entries[this->order[j]], this->entries[this->order[i]]) < 0) {
+            this->merge_buf[k++] = this->order[j++];
+        } else {
+            this->merge_buf[k++] = this->order[i++];
+        }
+    }
+
+    while (i < start) {
+        this->merge_buf[k++] = this->order[i++];
+    }
+
+    // Anything left over in the second half is already in place
+    memcpy(this->order, this->merge_buf, k * sizeof(uint32_t));
+}
+
+void dir_listing::insert_from(size_t start) {
+    if (this->num_rows - start > INSERT_SORT_MAX) {
+        this->sort_from(start);
+        return;
+    }
+
+    for (size_t row = start; row < this->num_rows; row++) {
+        const uint32_t index = this->order[row];
+        const path_segment &path = this->entries[index];
+        size_t pos;
+
+        this->find(this->names + path.name_offset, path.len, &pos, row);
+
+        memmove(this->order + pos + 1, this->order + pos, (row - pos) * sizeof(uint32_t));
+        this->order[pos] = index;
+    }
+}
+
+bool dir_listing::find(const char * const name, size_t len, size_t * row) const {
+    return this->find(name, len, row, this->num_rows);
+}
+
+bool dir_listing::find(const char * const name, size_t len, size_t * row, size_t num_rows) const {
+    size_t lo = 0;
+    size_t hi = num_rows;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const path_segment &path = this->entries[this->order[mid]];
+
+        if (name_cmp(this->names + path.name_offset, path.len, name, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *row = lo;
+
+    if (lo == num_rows) {
+        return false;
+    }
+
+    const path_segment &path = this->entries[this->order[lo]];
+
+    return name_cmp(this->names + path.name_offset, path.len, name, len) == 0;
+}
+
+void dir_listing::remove(size_t row) {
+    this->entries[this->order[row]].removed = true;
+}
+
+void dir_listing::remove_marked() {
+    size_t k = 0;
+
+    for (size_t row = 0; row < this->num_rows; row++) {
+        if (! this->entries[this->order[row]].removed) {
+            this->order[k++] = this->order[row];
+        }
+    }
+
+    this->num_rows = k;
+}
+
+void dir_listing::compact() {
+    if (this->num_rows == this->count) {
+        return;
+    }
+
+    dir_listing tmp;
+
+    for (size_t row = 0; row < this->num_rows; row++) {
+        const path_segment &src = this->at(row);
+        path_segment &dst = tmp.add(this->name(src), src.len);
+        uint32_t name_offset = dst.name_offset;
+
+        dst = src;
+        dst.name_offset = name_offset;
+        tmp.entry_flags[row] = this->entry_flags[this->order[row]];
+    }
+
+    this->swap(tmp);
+}
+
+size_t dir_listing::size() const {
+    return this->num_rows;
+}
+
+path_segment &dir_listing::at(size_t row) {
+    return this->entries[this->order[row]];
+}
+
+path_segment &dir_listing::entry(size_t index) {
+    return this->entries[index];
+}
+
+const path_segment &dir_listing::entry(size_t index) const {
+    return this->entries[index];
+}
+
+size_t dir_listing::num_entries() const {
+    return this->count;
+}
+
+uint32_t dir_listing::index_at(size_t row) const {
+    return this->order[row];
+}
+
+uint8_t dir_listing::flags(size_t index) const {
+    return this->entry_flags[index];
+}
+
+uint8_t dir_listing::flags_at(size_t row) const {
+    return this->entry_flags[this->order[row]];
+}
+
+const char * dir_listing::name(const path_segment &path) const {
+    return this->names + path.name_offset;
+}
+
+const char * dir_listing::name_pool() const {
+    return this->names;
+}
+
+size_t dir_listing::name_pool_size() const {
+    return this->names_len;
+}
+
+const uint32_t * dir_listing::sorted_indices() const {
+    return this->order;
+}
+
+void dir_listing::reserve_names(size_t min_cap) {
+    if (min_cap <= this->names_cap) {
+        return;
+    }
+
+    char * new_names = (char *) realloc(this->names, min_cap);
+    check_error(new_names, (char *) nullptr);
+
+    this->names = new_names;
+    this->names_cap = min_cap;
+}
+
+void dir_listing::reserve_entries(size_t min_cap) {
+    if (min_cap <= this->cap) {
+        return;
+    }
+
+    path_segment * new_entries = (path_segment *) realloc(this->entries, min_cap * sizeof(path_segment));
+    check_error(new_entries, (path_segment *) nullptr);
+    this->entries = new_entries;
+
+    uint8_t * new_flags = (uint8_t *) realloc(this->entry_flags, min_cap * sizeof(uint8_t));
+    check_error(new_flags, (uint8_t *) nullptr);
+    this->entry_flags = new_flags;
+
+    uint32_t * new_order = (uint32_t *) realloc(this->order, min_cap * sizeof(uint32_t));
+    check_error(new_order, (uint32_t *) nullptr);
+    this->order = new_order;
+
+    uint32_t * new_merge_buf = (uint32_t *) realloc(this->merge_buf, min_cap * sizeof(uint32_t));
+    check_error(new_merge_buf, (uint32_t *) nullptr);
+    this->merge_buf = new_merge_buf;
+
+    sort_key * new_keys = (sort_key *) realloc(this->keys, min_cap * sizeof(sort_key));
+    check_error(new_keys, (sort_key *) nullptr);
+    this->keys = new_keys;
+
+    this->cap = min_cap;
+}
@@ -0,0 +1,311 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "../include/dir_loader.h"
+#include "../include/util.h"
+
+dir_loader::dir_loader(unsigned int stat_threads) :
+    stats(stat_threads) {
+    this->generation = 0;
+    this->path[0] = '\0';
+    this->stopping = false;
+    this->read_names = true;
+    this->done = true;
+    this->error = 0;
+
+    this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    check_error(this->event_fd, -1);
+
+    this->worker = std::thread(&dir_loader::worker_loop, this);
+}
+
+dir_loader::~dir_loader() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+        // Make the worker drop whatever it's doing
+        this->generation++;
+    }
+
+    this->wake.notify_one();
+    this->worker.join();
+
+    close(this->event_fd);
+}
+
+void dir_loader::load(const char * const path) {
+    this->start(path, true);
+}
+
+void dir_loader::attach(const char * const path) {
+    this->start(path, false);
+}
+
+void dir_loader::cancel() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        this->path[0] = '\0';
+        this->pending.clear();
+        this->requests.clear();
+        this->request_indices.clear();
+        this->results.clear();
+        this->done = true;
+        this->error = LOAD_DONE;
+        this->generation++;
+    }
+
+    this->wake.notify_one();
+}
+
+void dir_loader::start(const char * const path, bool read_names) {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        size_t len = strlen(path);
+
+        memcpy(this->path, path, len + 1);
+        this->read_names = read_names;
+        this->pending.clear();
+        this->requests.clear();
+        this->request_indices.clear();
+        this->results.clear();
+        this->done = false;
+        this->error = 0;
+        this->generation++;
+    }
+
+    this->wake.notify_one();
+}
+
+int dir_loader::take(dir_listing &dest) {
+    uint64_t count;
+
+    // Reset the eventfd. This fails with EAGAIN if it wasn't set, which is fine
+    ssize_t retval = read(this->event_fd, &count, sizeof(count));
+    (void) retval;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    for (size_t i = 0; i < this->pending.size(); i++) {
+        const path_segment &src = this->pending.entry(i);
+        dest.add(this->pending.name(src), src.len, src.mode);
+    }
+
+    for (size_t i = 0; i < this->results.size(); i++) {
+        const stat_result &result = this->results[i];
+
+        dest.set_meta(result.index, result.mode, result.uid, result.gid);
+    }
+
+    this->pending.clear();
+    this->results.clear();
+
+    if (! this->done) {
+        return LOAD_IN_PROGRESS;
+    }
+
+    return this->error;
+}
+
+void dir_loader::request_stats(dir_listing &listing, size_t first_row, size_t last_row) {
+    bool added = false;
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        for (size_t row = first_row; row < last_row; row++) {
+            path_segment &path = listing.at(row);
+
+            if (path.meta == META_NONE) {
+                path.meta = META_REQUESTED;
+
+                // Keep the file type from the dirent in case the stat fails
+                this->requests.add(listing.name(path), path.len, path.mode);
+
+                this->request_indices.push_back(listing.index_at(row));
+                added = true;
+            }
+        }
+    }
+
+    if (added) {
+        this->wake.notify_one();
+    }
+}
+
+int dir_loader::fd() const {
+    return this->event_fd;
+}
+
+void dir_loader::set_perf(perf_stats * perf) {
+    this->reader.set_perf(perf);
+}
+
+void dir_loader::worker_loop() {
+    // The load whose directory is open
+    unsigned long current = 0;
+
+    while (1) {
+        unsigned long gen;
+        bool new_load;
+        bool should_read_names = true;
+        char load_path[PATH_MAX + 1];
+
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+
+            while (! this->stopping && this->generation == current && this->requests.size() == 0) {
+                this->wake.wait(guard);
+            }
+
+            if (this->stopping) {
+                return;
+            }
+
+            new_load = this->generation != current;
+            gen = current = this->generation;
+
+            if (new_load) {
+                memcpy(load_path, this->path, strlen(this->path) + 1);
+                should_read_names = this->read_names;
+            }
+        }
+
+        if (! new_load) {
+            this->serve_requests(gen);
+            continue;
+        }
+
+        if (load_path[0] == '\0') {
+            // Cancelled; there's nothing to report
+            this->reader.close();
+            continue;
+        }
+
+        int err = LOAD_DONE;
+
+        try {
+            // The directory stays open after this so that metadata can be looked
+            // up relative to it
+            this->reader.open(load_path);
+
+            if (should_read_names) {
+                this->load_names(gen);
+            }
+        } catch (int e) {
+            err = e;
+            this->reader.close();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+
+            if (this->generation != gen) {
+                continue;
+            }
+
+            this->done = true;
+            this->error = err;
+        }
+
+        this->notify();
+    }
+}
+
+void dir_loader::load_names(unsigned long gen) {
+    while (1) {
+        if (! this->serve_requests(gen)) {
+            return;
+        }
+
+        this->batch.clear();
+
+        size_t num_read = this->reader.read_batch(this->batch);
+
+        if (num_read == 0) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+
+            if (this->generation != gen) {
+                return;
+            }
+
+            for (size_t i = 0; i < num_read; i++) {
+                const path_segment &src = this->batch.entry(i);
+                this->pending.add(this->batch.name(src), src.len, src.mode);
+            }
+        }
+
+        this->notify();
+    }
+}
+
+bool dir_loader::serve_requests(unsigned long gen) {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if (this->generation != gen) {
+            return false;
+        }
+
+        this->working.swap(this->requests);
+        this->working_indices.swap(this->request_indices);
+        this->requests.clear();
+        this->request_indices.clear();
+    }
+
+    for (size_t start = 0; start < this->working.size(); start += LOADER_CANCEL_CHECK_INTERVAL) {
+        if (this->generation != gen) {
+            return false;
+        }
+
+        size_t end = start + LOADER_CANCEL_CHECK_INTERVAL < this->working.size() ? start + LOADER_CANCEL_CHECK_INTERVAL : this->working.size();
+
+        this->stats.stat_range(this->reader, this->working, start, end);
+
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+
+            if (this->generation != gen) {
+                return false;
+            }
+
+            for (size_t i = start; i < end; i++) {
+                const path_segment &path = this->working.entry(i);
+
+                this->results.push_back({ this->working_indices[i], path.mode, path.uid, path.gid });
+            }
+        }
+
+        this->notify();
+    }
+
+    return this->generation == gen;
+}
+
+void dir_loader::notify() {
+    uint64_t one = 1;
+    ssize_t retval = write(this->event_fd, &one, sizeof(one));
+    check_error(retval, (ssize_t) -1);
+}
@@ -0,0 +1,466 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <sys/stat.h>
+#include "../include/dir_model.h"
+#include "../include/util.h"
+
+dir_model::dir_model(const char * const path, size_t cache_budget) : cache(cache_budget), sizer(SIZER_THREADS), search(SEARCH_THREADS) {
+    this->path_len = strlen(path);
+    memcpy(this->path, path, this->path_len + 1);
+    this->filter_stale = false;
+    this->searching = false;
+    this->search_running = false;
+    this->search_root_len = 0;
+    this->load_done = false;
+    this->from_snapshot = false;
+
+    this->loader.set_perf(&this->perf);
+    this->enter_path();
+}
+
+const char * dir_model::cwd() const {
+    return this->path;
+}
+
+size_t dir_model::cwd_len() const {
+    return this->path_len;
+}
+
+bool dir_model::navigate(const char * const name, size_t len) {
+    if (! join_fits(this->path_len, name, len)) {
+        return false;
+    }
+
+    this->search_root_len = this->searching ? this->path_len : 0;
+    path_join(this->path, &this->path_len, name, len);
+    this->enter_path();
+
+    return true;
+}
+
+void dir_model::open(const char * const path) {
+    const size_t len = strlen(path);
+
+    if (len > PATH_MAX) {
+        return;
+    }
+
+    memcpy(this->path, path, len + 1);
+    this->path_len = len;
+    this->search_root_len = 0;
+    this->enter_path();
+}
+
+void dir_model::enter_path() {
+    this->perf.reset();
+    this->prefetcher.cancel(this->cache);
+
+    // `name` may have pointed into the results, so this has to wait until now
+    if (this->searching) {
+        this->stop_search();
+    }
+
+    // Bring the listing up to date so that it can be cached
+    if (this->load_done && this->cache.has_changes()) {
+        this->cache.apply_changes(this->children);
+        this->from_snapshot = false;
+    }
+
+    this->save_snapshot();
+    this->cache.leave(this->children, this->load_done);
+    this->sizes.clear();
+
+    const bool cached = this->cache.enter(this->path, this->children);
+
+    this->prefetcher.on_enter(this->path, cached);
+
+    // The cache is watching the directory by now, so if it changes after the
+    // snapshot is checked, the change still shows up
+    this->from_snapshot = ! cached && this->snapshots.load(this->path, this->children);
+
+    if (cached || this->from_snapshot) {
+        this->loader.attach(this->path);
+        this->load_done = true;
+        this->perf.load_ns = perf_now_ns() - this->perf.navigate_ns;
+        this->sizer.start(this->path, this->children);
+    } else {
+        this->loader.load(this->path);
+        this->load_done = false;
+        this->sizer.cancel();
+    }
+
+    this->clear_filter();
+}
+
+void dir_model::save_snapshot() {
+    if (! this->load_done || this->from_snapshot || this->children.size() < SNAPSHOT_MIN_ENTRIES) {
+        return;
+    }
+
+    struct stat dir_stat;
+
+    if (stat(this->path, &dir_stat) == -1) {
+        return;
+    }
+
+    // Anything that changed the directory before the stat is in the inotify queue
+    // by now. If nothing is, the listing matches the mtime we got.
+    this->cache.on_inotify();
+
+    if (! this->cache.current_up_to_date() || this->cache.has_changes()) {
+        return;
+    }
+
+    this->snapshots.save(this->path, this->children, dir_stat);
+}
+
+void dir_model::path_join(char * const wd, size_t * wd_len, const char * const name, size_t name_len) {
+    if (name_len == 1 && name[0] == '.') {
+        // Do nothing
+        return;
+    } else if (*wd_len == 1 && wd[0] == '/') {
+        if (name_len == 2 && name[0] == '.' && name[1] == '.') {
+            // Can't go up from root
+            return;
+        }
+
+        // Root - just append the next thing
+        memcpy(wd + 1, name, name_len);
+        *wd_len = name_len + 1;
+        wd[name_len + 1] = '\0';
+    } else if (name_len == 2 && name[0] == '.' && name[1] == '.') {
+        // Strip out last part of path
+        int slashpos = *wd_len;
+
+        while (slashpos && (wd[--slashpos] != '/'));
+
+        if (slashpos == 0) {
+            // Last slash is root, so leave it in
+            wd[1] = '\0';
+            *wd_len = 1;
+        } else {
+            *wd_len = slashpos;
+            wd[slashpos] = '\0';
+        }
+    } else {
+        wd[*wd_len] = '/';
+        memcpy(wd + *wd_len + 1, name, name_len);
+        *wd_len += name_len + 1;
+        wd[*wd_len] = '\0';
+    }
+}
+
+bool dir_model::join_fits(size_t wd_len, const char * const name, size_t name_len) {
+    // These never make the path longer
+    if (is_dot_or_dotdot(name, name_len)) {
+        return true;
+    }
+
+    return wd_len + 1 + name_len <= PATH_MAX;
+}
+
+int dir_model::on_load_progress() {
+    size_t old_size = this->children.size();
+    int retval = this->loader.take(this->children);
+    const unsigned long long start = this->perf.start();
+
+    this->children.sort_from(old_size);
+    perf_stats::stop(this->perf.sort, start);
+    this->filter_stale = true;
+
+    if (retval == LOAD_DONE && ! this->load_done) {
+        // Metadata keeps coming in after the names are done; sizing only starts once
+        this->load_done = true;
+        this->perf.load_ns = perf_now_ns() - this->perf.navigate_ns;
+        this->sizer.start(this->path, this->children);
+    } else if (retval != LOAD_IN_PROGRESS && retval != LOAD_DONE && this->search_root_len != 0) {
+        // The parent of a search result isn't where the user was
+        this->path_len = this->search_root_len;
+        this->path[this->path_len] = '\0';
+        this->search_root_len = 0;
+        this->enter_path();
+    } else if (retval != LOAD_IN_PROGRESS && retval != LOAD_DONE && this->path_len > 1) {
+        // Go back up instead of leaving an empty listing with no way out
+        this->navigate("..", 2);
+    }
+
+    return retval;
+}
+
+bool dir_model::is_load_done() const {
+    return this->load_done;
+}
+
+bool dir_model::on_cache_event() {
+    this->cache.on_inotify();
+
+    if (! this->cache.current_up_to_date() && this->load_done) {
+        // We've lost track of the current directory. Load it again; if it's gone,
+        // the load fails and we go up a level.
+        this->navigate(".", 1);
+
+        return true;
+    }
+
+    return false;
+}
+
+bool dir_model::has_live_changes() const {
+    return this->load_done && this->cache.has_changes();
+}
+
+unsigned long long dir_model::live_changes_since() const {
+    return this->cache.changes_since();
+}
+
+size_t dir_model::apply_live_changes(size_t top) {
+    char top_name[NAME_MAX + 1];
+    size_t top_len = 0;
+
+    if (! this->searching && top > 0 && top < this->num_shown()) {
+        const path_segment &entry = this->children.at(this->shown_row(top));
+
+        top_len = entry.len;
+        memcpy(top_name, this->children.name(entry), top_len);
+    }
+
+    const size_t old_entries = this->children.num_entries();
+
+    this->cache.apply_changes(this->children);
+    this->filter_stale = true;
+    this->from_snapshot = false;
+    this->sizer.add(this->children, old_entries);
+
+    if (top_len == 0) {
+        return top;
+    }
+
+    size_t row;
+
+    // If the top entry was deleted, this is the entry after it
+    this->children.find(top_name, top_len, &row);
+    this->update_filter();
+
+    return this->filter.active() ? this->filter.position_of(row) : row;
+}
+
+void dir_model::set_filter(const char * const query, size_t len) {
+    if (this->filter_stale) {
+        // The old matches are out of date, so they can't be narrowed down
+        this->filter.set_query(this->children, query, 0);
+        this->filter_stale = false;
+    }
+
+    this->filter.set_query(this->children, query, len);
+}
+
+void dir_model::clear_filter() {
+    this->filter.set_query(this->children, "", 0);
+}
+
+bool dir_model::is_filtered() const {
+    return this->filter.active();
+}
+
+void dir_model::update_filter() {
+    if (this->filter_stale) {
+        this->filter.rematch(this->children);
+        this->filter_stale = false;
+    }
+}
+
+void dir_model::start_search(const char * const query, size_t len, int max_depth) {
+    this->clear_filter();
+    this->search_results.clear();
+    this->searching = true;
+    this->search_running = true;
+    this->search.start(this->path, query, len, max_depth);
+}
+
+void dir_model::stop_search() {
+    this->search.cancel();
+    this->searching = false;
+    this->search_running = false;
+    this->search_results.clear();
+}
+
+bool dir_model::is_searching() const {
+    return this->searching;
+}
+
+bool dir_model::is_search_running() const {
+    return this->search_running;
+}
+
+bool dir_model::on_search_progress() {
+    size_t old_size = this->search_results.size();
+
+    this->search_running = this->search.take(this->search_results);
+
+    if (! this->searching) {
+        return false;
+    }
+
+    this->search_results.sort_from(old_size);
+
+    return true;
+}
+
+size_t dir_model::search_dirs_searched() {
+    return this->search.dirs_searched();
+}
+
+uint32_t dir_model::on_size_progress() {
+    return this->sizer.take(this->sizes);
+}
+
+const dir_size * dir_model::size_of(uint32_t index) const {
+    if (index >= this->sizes.size() || this->sizes[index].state == SIZE_NONE) {
+        return nullptr;
+    }
+
+    return &this->sizes[index];
+}
+
+size_t dir_model::num_shown() const {
+    if (this->searching) {
+        return this->search_results.size();
+    }
+
+    return this->filter.active() ? this->filter.size() : this->children.size();
+}
+
+size_t dir_model::shown_row(size_t i) const {
+    if (this->searching) {
+        return i;
+    }
+
+    return this->filter.active() ? this->filter.row(i) : i;
+}
+
+dir_listing &dir_model::shown_listing() {
+    return this->searching ? this->search_results : this->children;
+}
+
+const dir_listing &dir_model::listing() const {
+    return this->children;
+}
+
+void dir_model::request_shown_stats(size_t first, size_t last) {
+    if (this->searching) {
+        // The loader only knows about the current directory. Search results have
+        // the file type from the dirent, which is all that's drawn.
+        return;
+    }
+
+    if (! this->filter.active()) {
+        this->loader.request_stats(this->children, first, last);
+        return;
+    }
+
+    // The matches are scattered through the listing
+    for (size_t i = first; i < last; i++) {
+        size_t row = this->filter.row(i);
+
+        this->loader.request_stats(this->children, row, row + 1);
+    }
+}
+
+void dir_model::prefetch_around(size_t entry) {
+    // The entry itself first, then its neighbours
+    const long offsets[] = { 0, 1, -1 };
+
+    if (! this->load_done || this->searching) {
+        return;
+    }
+
+    for (size_t i = 0; i < c_arr_size(offsets); i++) {
+        if (offsets[i] != 0 && this->prefetcher.is_running()) {
+            return;
+        }
+
+        const long shown = (long) entry + offsets[i];
+
+        if (shown < 0 || (size_t) shown >= this->num_shown()) {
+            continue;
+        }
+
+        const size_t row = this->shown_row(shown);
+        const uint8_t flags = this->children.flags_at(row);
+        const path_segment &path = this->children.at(row);
+
+        if (! (flags & ENTRY_DIR) || ! (flags & ENTRY_PERMITTED) || this->path_len + 1 + path.len > PATH_MAX) {
+            continue;
+        }
+
+        char dest[PATH_MAX + 1];
+        size_t dest_len = this->path_len;
+
+        memcpy(dest, this->path, dest_len + 1);
+        path_join(dest, &dest_len, this->children.name(path), path.len);
+
+        if (this->cache.contains(dest) || this->prefetcher.has(dest)) {
+            continue;
+        }
+
+        this->prefetcher.start(dest, this->cache);
+
+        return;
+    }
+}
+
+bool dir_model::on_prefetch_progress() {
+    return this->prefetcher.on_progress(this->cache);
+}
+
+const dir_prefetcher &dir_model::get_prefetcher() const {
+    return this->prefetcher;
+}
+
+const dir_cache &dir_model::get_cache() const {
+    return this->cache;
+}
+
+const listing_snapshots &dir_model::get_snapshots() const {
+    return this->snapshots;
+}
+
+perf_stats &dir_model::get_perf() {
+    return this->perf;
+}
+
+int dir_model::load_fd() const {
+    return this->loader.fd();
+}
+
+int dir_model::cache_fd() const {
+    return this->cache.fd();
+}
+
+int dir_model::search_fd() const {
+    return this->search.fd();
+}
+
+int dir_model::size_fd() const {
+    return this->sizer.fd();
+}
+
+int dir_model::prefetch_fd() const {
+    return this->prefetcher.fd();
+}
@@ -0,0 +1,147 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "../include/dir_prefetcher.h"
+#include "../include/util.h"
+
+dir_prefetcher::dir_prefetcher() : loader(0) {
+    this->hits = 0;
+    this->wasted = 0;
+    this->abandoned = 0;
+    this->path[0] = '\0';
+    this->running = false;
+    this->names_done = false;
+}
+
+dir_prefetcher::~dir_prefetcher() {
+    for (size_t i = 0; i < this->ready.size(); i++) {
+        free(this->ready[i]);
+    }
+}
+
+void dir_prefetcher::start(const char * const path, dir_cache &cache) {
+    const size_t len = strlen(path);
+
+    this->cancel(cache);
+
+    if (len > PATH_MAX || ! cache.begin_prefetch(path)) {
+        return;
+    }
+
+    memcpy(this->path, path, len + 1);
+    this->listing.clear();
+    this->running = true;
+    this->names_done = false;
+    this->loader.load(path);
+}
+
+void dir_prefetcher::cancel(dir_cache &cache) {
+    if (! this->running) {
+        return;
+    }
+
+    this->abandoned++;
+    this->running = false;
+    this->loader.cancel();
+    this->listing.clear();
+    cache.cancel_prefetch();
+}
+
+bool dir_prefetcher::is_running() const {
+    return this->running;
+}
+
+bool dir_prefetcher::has(const char * const path) const {
+    if (this->running && strcmp(this->path, path) == 0) {
+        return true;
+    }
+
+    for (size_t i = 0; i < this->ready.size(); i++) {
+        if (strcmp(this->ready[i], path) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool dir_prefetcher::on_progress(dir_cache &cache) {
+    int retval = this->loader.take(this->listing);
+
+    // Left over from a prefetch that was cancelled
+    if (! this->running) {
+        return false;
+    }
+
+    if (! this->names_done) {
+        if (this->listing.num_entries() > PREFETCH_MAX_ENTRIES || (retval != LOAD_IN_PROGRESS && retval != LOAD_DONE)) {
+            this->cancel(cache);
+            return false;
+        }
+
+        if (retval == LOAD_IN_PROGRESS) {
+            return false;
+        }
+
+        this->listing.sort();
+        this->names_done = true;
+        this->loader.request_stats(this->listing, 0, this->listing.size() < PREFETCH_STAT_ROWS ? this->listing.size() : PREFETCH_STAT_ROWS);
+    }
+
+    for (size_t row = 0; row < this->listing.size() && row < PREFETCH_STAT_ROWS; row++) {
+        if (this->listing.at(row).meta != META_DONE) {
+            return false;
+        }
+    }
+
+    // Done with the directory; close it
+    this->loader.cancel();
+    this->running = false;
+    cache.finish_prefetch(this->listing);
+
+    if (this->ready.size() == PREFETCH_MAX_READY) {
+        free(this->ready[0]);
+        this->ready.erase(this->ready.begin());
+        this->wasted++;
+    }
+
+    char * ready_path = strdup(this->path);
+    check_error(ready_path, (char *) nullptr);
+    this->ready.push_back(ready_path);
+
+    return true;
+}
+
+void dir_prefetcher::on_enter(const char * const path, bool cached) {
+    for (size_t i = 0; i < this->ready.size(); i++) {
+        if (cached && strcmp(this->ready[i], path) == 0) {
+            this->hits++;
+        } else {
+            this->wasted++;
+        }
+
+        free(this->ready[i]);
+    }
+
+    this->ready.clear();
+}
+
+int dir_prefetcher::fd() const {
+    return this->loader.fd();
+}
@@ -0,0 +1,150 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../include/dir_reader.h"
+#include "../include/util.h"
+
+// We only ever use the file type, permission bits and owner, so those are the
+// only fields we ask for. AT_STATX_DONT_SYNC lets network filesystems answer
+// from their attribute cache instead of going back to the server.
+const unsigned int STATX_FIELDS = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID;
+const int STATX_FLAGS = AT_STATX_DONT_SYNC | AT_NO_AUTOMOUNT;
+
+dir_reader::dir_reader() {
+    this->perf = nullptr;
+    this->dir_fd = -1;
+    this->buf = (char *) malloc(DIRENT_BUF_SIZE);
+    check_error(this->buf, (char *) nullptr);
+    this->buf_len = 0;
+    this->buf_pos = 0;
+    this->at_end = true;
+}
+
+dir_reader::~dir_reader() {
+    this->close();
+    free(this->buf);
+}
+
+void dir_reader::open(const char * const path, int extra_flags) {
+    this->close();
+
+    this->dir_fd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | extra_flags);
+    check_error(this->dir_fd, -1);
+
+    this->buf_len = 0;
+    this->buf_pos = 0;
+    this->at_end = false;
+}
+
+void dir_reader::close() {
+    if (this->dir_fd != -1) {
+        int retval = ::close(this->dir_fd);
+        check_error(retval, -1);
+        this->dir_fd = -1;
+    }
+}
+
+size_t dir_reader::read_batch(dir_listing &listing) {
+    if (this->at_end) {
+        return 0;
+    }
+
+    if (this->buf_pos >= this->buf_len) {
+        const unsigned long long start = this->perf ? this->perf->start() : 0;
+        ssize_t bytes = getdents64(this->dir_fd, this->buf, DIRENT_BUF_SIZE);
+        check_error(bytes, (ssize_t) -1);
+
+        if (start) {
+            perf_stats::stop(this->perf->readdir, start);
+        }
+
+        if (bytes == 0) {
+            this->at_end = true;
+            return 0;
+        }
+
+        this->buf_len = bytes;
+        this->buf_pos = 0;
+    }
+
+    size_t added = 0;
+
+    while (this->buf_pos < this->buf_len) {
+        struct dirent64 * entry = (struct dirent64 *) (this->buf + this->buf_pos);
+        // DT_UNKNOWN maps to 0, which is treated as a regular file until stat'd
+        listing.add(entry->d_name, strlen(entry->d_name), DTTOIF(entry->d_type));
+
+        this->buf_pos += entry->d_reclen;
+        added++;
+    }
+
+    return added;
+}
+
+bool dir_reader::stat_entry(dir_listing &listing, size_t index) const {
+    const path_segment &path = listing.entry(index);
+    const char * const name = listing.name(path);
+    const unsigned long long start = this->perf ? this->perf->start() : 0;
+    struct statx stx;
+    int retval;
+
+    if (path.len == 1 && name[0] == '.') {
+        // We already have the directory open, no need to look it up again
+        retval = statx(this->dir_fd, "", STATX_FLAGS | AT_EMPTY_PATH, STATX_FIELDS, &stx);
+    } else {
+        retval = statx(this->dir_fd, name, STATX_FLAGS, STATX_FIELDS, &stx);
+    }
+
+    if (start) {
+        perf_stats::stop(this->perf->stat, start);
+    }
+
+    if (retval == -1) {
+        // Keep the file type from the dirent. Without permission bits, the entry
+        // shows up as not permitted.
+        listing.set_meta(index, path.mode, path.uid, path.gid);
+
+        return false;
+    }
+
+    listing.set_meta(index, stx.stx_mode, stx.stx_uid, stx.stx_gid);
+
+    return true;
+}
+
+int dir_reader::fd() const {
+    return this->dir_fd;
+}
+
+void dir_reader::set_perf(perf_stats * perf) {
+    this->perf = perf;
+}
+
+dev_t dir_reader::device() const {
+    struct stat st;
+
+    int retval = fstat(this->dir_fd, &st);
+    check_error(retval, -1);
+
+    return st.st_dev;
+}
@@ -0,0 +1,455 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include "../include/dir_reader.h"
+#include "../include/dir_sizer.h"
+#include "../include/perf_stats.h"
+#include "../include/util.h"
+
+// Everything needed to add up a directory and decide whether to go into it
+const unsigned int SIZE_STATX_FIELDS = STATX_TYPE | STATX_INO | STATX_MTIME | STATX_BLOCKS;
+const int SIZE_STATX_FLAGS = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC | AT_NO_AUTOMOUNT;
+
+// Returns `dir`/`name` in a buffer from malloc
+static char * join_path(const char * const dir, size_t dir_len, const char * const name, size_t name_len) {
+    char * path = (char *) malloc(dir_len + name_len + 2);
+    check_error(path, (char *) nullptr);
+
+    // Paths under / don't get an extra slash
+    if (dir_len == 1) {
+        dir_len = 0;
+    }
+
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+
+    return path;
+}
+
+static size_key key_of(const struct statx &stx) {
+    return { makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino, stx.stx_mtime.tv_sec * 1000000000ll + stx.stx_mtime.tv_nsec };
+}
+
+dir_sizer::dir_sizer(unsigned int num_threads) {
+    this->num_threads = num_threads;
+    this->stopping = false;
+    this->generation = 0;
+    this->path[0] = '\0';
+    this->path_len = 0;
+    this->num_updates = 0;
+    this->notified = false;
+    this->last_notify_ns = 0;
+
+    this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    check_error(this->event_fd, -1);
+
+    this->threads = new std::thread[num_threads];
+
+    for (unsigned int i = 0; i < num_threads; i++) {
+        this->threads[i] = std::thread(&dir_sizer::worker_loop, this);
+    }
+}
+
+dir_sizer::~dir_sizer() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+        this->generation++;
+    }
+
+    this->wake.notify_all();
+
+    for (unsigned int i = 0; i < this->num_threads; i++) {
+        this->threads[i].join();
+    }
+
+    // Finishing the leftover nodes frees them and everything they were holding up
+    for (size_t i = 0; i < this->stack.size(); i++) {
+        this->finish(this->stack[i]);
+    }
+
+    delete[] this->threads;
+    close(this->event_fd);
+}
+
+void dir_sizer::start(const char * const path, const dir_listing &listing) {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        this->generation++;
+        this->path_len = strlen(path);
+        memcpy(this->path, path, this->path_len + 1);
+        this->results.clear();
+        this->changed.clear();
+        this->dirty.clear();
+    }
+
+    this->add(listing, 0);
+}
+
+void dir_sizer::add(const dir_listing &listing, size_t first) {
+    std::vector<size_node *> roots;
+
+    // Pushed bottom row first, so that the top row comes off the stack first
+    for (size_t row = listing.size(); row-- > 0;) {
+        const uint32_t index = listing.index_at(row);
+        const path_segment &entry = listing.entry(index);
+
+        // A mode of 0 means the file type isn't known yet. ".." would be the whole
+        // parent, and "." is everything else put together.
+        if (index < first || (entry.mode != 0 && ! S_ISDIR(entry.mode)) || is_dot_or_dotdot(listing.name(entry), entry.len)) {
+            continue;
+        }
+
+        if (this->path_len + 1 + entry.len > PATH_MAX) {
+            continue;
+        }
+
+        size_node * node = new size_node;
+        node->parent = nullptr;
+        node->path = join_path(this->path, this->path_len, listing.name(entry), entry.len);
+        node->keyed = false;
+        node->failed = false;
+        node->job = index;
+        node->bytes = 0;
+        node->pending = 1;
+        roots.push_back(node);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if (this->results.size() < listing.num_entries()) {
+            this->results.resize(listing.num_entries(), { 0, 0, SIZE_NONE });
+            this->dirty.resize(listing.num_entries(), false);
+        }
+
+        for (size_t i = 0; i < roots.size(); i++) {
+            roots[i]->gen = this->generation;
+            this->stack.push_back(roots[i]);
+        }
+    }
+
+    this->wake.notify_all();
+}
+
+void dir_sizer::cancel() {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    // Nodes from the cancelled job are dropped as the workers come to them
+    this->generation++;
+    this->results.clear();
+    this->changed.clear();
+    this->dirty.clear();
+}
+
+uint32_t dir_sizer::take(std::vector<dir_size> &sizes) {
+    uint64_t count;
+
+    // Reset the eventfd. This fails with EAGAIN if it wasn't set, which is fine
+    ssize_t retval = read(this->event_fd, &count, sizeof(count));
+    (void) retval;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    this->notified = false;
+
+    if (this->changed.empty()) {
+        return 0;
+    }
+
+    // 0 means nothing changed, so it's never used as an update number
+    if (++this->num_updates == 0) {
+        this->num_updates = 1;
+    }
+
+    if (sizes.size() < this->results.size()) {
+        sizes.resize(this->results.size(), { 0, 0, SIZE_NONE });
+    }
+
+    for (size_t i = 0; i < this->changed.size(); i++) {
+        const uint32_t index = this->changed[i];
+
+        sizes[index] = this->results[index];
+        sizes[index].update = this->num_updates;
+        this->dirty[index] = false;
+    }
+
+    this->changed.clear();
+
+    return this->num_updates;
+}
+
+int dir_sizer::fd() const {
+    return this->event_fd;
+}
+
+void dir_sizer::worker_loop() {
+    // Only touched by this thread
+    dir_reader reader;
+    dir_listing batch;
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while (1) {
+        while (! this->stopping && this->stack.empty()) {
+            this->wake.wait(guard);
+        }
+
+        if (this->stopping) {
+            return;
+        }
+
+        size_node * node = this->stack.back();
+        this->stack.pop_back();
+
+        if (node->gen != this->generation) {
+            this->finish(node);
+            continue;
+        }
+
+        guard.unlock();
+        this->measure(node, reader, batch);
+        guard.lock();
+    }
+}
+
+void dir_sizer::measure(size_node * node, dir_reader &reader, dir_listing &batch) {
+    std::vector<size_node *> subdirs;
+    const size_t path_len = strlen(node->path);
+    struct statx stx;
+    // Everything in the directory but its subdirectories
+    uint64_t bytes = 0;
+    // The subdirectories' own blocks. Their contents are counted when they're read.
+    uint64_t subdir_bytes = 0;
+    uint64_t cached;
+
+    if (! node->keyed) {
+        int retval = statx(AT_FDCWD, node->path, SIZE_STATX_FLAGS, SIZE_STATX_FIELDS, &stx);
+
+        if (retval == -1 || ! S_ISDIR(stx.stx_mode)) {
+            std::lock_guard<std::mutex> guard(this->lock);
+
+            node->failed = true;
+            this->finish(node);
+
+            return;
+        }
+
+        node->key = key_of(stx);
+        node->keyed = true;
+
+        if (this->lookup(node->key, &cached)) {
+            std::lock_guard<std::mutex> guard(this->lock);
+
+            node->bytes = cached;
+            this->finish(node);
+
+            return;
+        }
+
+        bytes = stx.stx_blocks * 512;
+    }
+
+    try {
+        reader.open(node->path, O_NOFOLLOW);
+
+        while (node->gen == this->generation) {
+            batch.clear();
+
+            size_t num_read = reader.read_batch(batch);
+
+            if (num_read == 0) {
+                break;
+            }
+
+            for (size_t i = 0; i < num_read; i++) {
+                const path_segment &entry = batch.entry(i);
+                const char * const name = batch.name(entry);
+
+                if (is_dot_or_dotdot(name, entry.len) || statx(reader.fd(), name, SIZE_STATX_FLAGS, SIZE_STATX_FIELDS, &stx) == -1) {
+                    continue;
+                }
+
+                const uint64_t own = stx.stx_blocks * 512;
+
+                if (! S_ISDIR(stx.stx_mode)) {
+                    bytes += own;
+                    continue;
+                }
+
+                const size_key key = key_of(stx);
+
+                if (key.dev != node->key.dev || path_len + 1 + entry.len > PATH_MAX) {
+                    // Another filesystem is mounted here; only the mount point counts
+                    bytes += own;
+                } else if (this->lookup(key, &cached)) {
+                    bytes += cached;
+                } else {
+                    size_node * child = new size_node;
+                    child->parent = node;
+                    child->path = join_path(node->path, path_len, name, entry.len);
+                    child->key = key;
+                    child->keyed = true;
+                    child->failed = false;
+                    child->job = node->job;
+                    child->gen = node->gen;
+                    child->bytes = own;
+                    child->pending = 1;
+                    subdirs.push_back(child);
+                    subdir_bytes += own;
+                }
+            }
+        }
+
+        reader.close();
+    } catch (int e) {
+        // Unreadable directories count as empty, like `du` does
+        reader.close();
+    }
+
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    node->bytes += bytes;
+
+    if (node->gen == this->generation) {
+        this->publish(node->job, bytes + subdir_bytes, false);
+    }
+
+    for (size_t i = 0; i < subdirs.size(); i++) {
+        this->stack.push_back(subdirs[i]);
+    }
+
+    node->pending += subdirs.size();
+
+    if (--node->pending == 0) {
+        this->finish(node);
+    }
+
+    if (subdirs.size() > 1) {
+        this->wake.notify_all();
+    } else if (subdirs.size() == 1) {
+        this->wake.notify_one();
+    }
+}
+
+void dir_sizer::finish(size_node * node) {
+    while (1) {
+        const uint64_t total = node->bytes;
+        // Totals from an abandoned job may be missing whatever was skipped when it
+        // was abandoned, so they're thrown away
+        const bool current = node->gen == this->generation && ! node->failed;
+
+        if (current) {
+            this->remember(node->key, total);
+
+            if (! node->parent) {
+                this->publish(node->job, total, true);
+            }
+        }
+
+        size_node * parent = node->parent;
+
+        free(node->path);
+        delete node;
+
+        if (! parent) {
+            return;
+        }
+
+        parent->bytes += total;
+
+        if (--parent->pending != 0) {
+            return;
+        }
+
+        node = parent;
+    }
+}
+
+void dir_sizer::publish(uint32_t job, uint64_t bytes, bool done) {
+    if (job >= this->results.size()) {
+        return;
+    }
+
+    dir_size &size = this->results[job];
+
+    if (done) {
+        size.bytes = bytes;
+        size.state = SIZE_DONE;
+    } else {
+        size.bytes += bytes;
+        size.state = SIZE_PARTIAL;
+    }
+
+    if (! this->dirty[job]) {
+        this->dirty[job] = true;
+        this->changed.push_back(job);
+    }
+
+    // Running totals change with every directory, which is far more often than
+    // they can be drawn
+    const long long now = perf_now_ns();
+
+    if (this->notified || (! done && now - this->last_notify_ns < SIZE_UPDATE_INTERVAL_MS * 1000000ll)) {
+        return;
+    }
+
+    this->notified = true;
+    this->last_notify_ns = now;
+
+    uint64_t one = 1;
+    ssize_t retval = write(this->event_fd, &one, sizeof(one));
+    check_error(retval, (ssize_t) -1);
+}
+
+bool dir_sizer::lookup(const size_key &key, uint64_t * bytes) {
+    std::lock_guard<std::mutex> guard(this->cache_lock);
+
+    auto it = this->cache.find(key);
+
+    if (it == this->cache.end()) {
+        return false;
+    }
+
+    if (perf_now_ns() - it->second.counted_ns > SIZE_CACHE_MAX_AGE_MS * 1000000ull) {
+        this->cache.erase(it);
+
+        return false;
+    }
+
+    *bytes = it->second.bytes;
+
+    return true;
+}
+
+void dir_sizer::remember(const size_key &key, uint64_t bytes) {
+    std::lock_guard<std::mutex> guard(this->cache_lock);
+
+    if (this->cache.size() >= SIZE_CACHE_MAX_ENTRIES) {
+        this->cache.clear();
+    }
+
+    this->cache[key] = { bytes, perf_now_ns() };
+}
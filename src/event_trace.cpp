@@ -0,0 +1,121 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <X11/Xutil.h>
+#include "../include/event_trace.h"
+#include "../include/perf_stats.h"
+#include "../include/util.h"
+
+trace_writer::trace_writer(const char * const path) {
+    this->out = nullptr;
+    this->first_ns = 0;
+
+    if (! path) {
+        return;
+    }
+
+    this->out = fopen(path, "w");
+    check_error(this->out, (FILE *) NULL);
+
+    fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, this->out);
+    fwrite(&TRACE_VERSION, sizeof(TRACE_VERSION), 1, this->out);
+}
+
+trace_writer::~trace_writer() {
+    if (this->out) {
+        fclose(this->out);
+    }
+}
+
+bool trace_writer::is_recording() const {
+    return this->out != nullptr;
+}
+
+void trace_writer::record(const XEvent &event) {
+    if (! this->out) {
+        return;
+    }
+
+    trace_event rec;
+    const unsigned long long now = perf_now_ns();
+
+    if (this->first_ns == 0) {
+        this->first_ns = now;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ns = now - this->first_ns;
+    rec.type = event.type;
+
+    switch (event.type) {
+        case ButtonPress:
+            rec.state = event.xbutton.state;
+            rec.detail = event.xbutton.button;
+            rec.x = event.xbutton.x;
+            rec.y = event.xbutton.y;
+            break;
+        case KeyPress:
+            // XLookupKeysym doesn't take a const event, but doesn't change it either
+            rec.state = event.xkey.state;
+            rec.detail = XLookupKeysym(const_cast<XKeyEvent *>(&event.xkey), 0);
+            rec.x = event.xkey.x;
+            rec.y = event.xkey.y;
+            break;
+        case MotionNotify:
+            rec.state = event.xmotion.state;
+            rec.x = event.xmotion.x;
+            rec.y = event.xmotion.y;
+            break;
+        case Expose:
+            rec.x = event.xexpose.x;
+            rec.y = event.xexpose.y;
+            rec.width = event.xexpose.width;
+            rec.height = event.xexpose.height;
+            break;
+        default:
+            return;
+    }
+
+    fwrite(&rec, sizeof(rec), 1, this->out);
+}
+
+bool read_trace(const char * const path, std::vector<trace_event> &events) {
+    FILE * in = fopen(path, "r");
+    check_error(in, (FILE *) NULL);
+
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32_t version;
+
+    if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, in) != 1 || version != TRACE_VERSION) {
+        fclose(in);
+
+        return false;
+    }
+
+    trace_event rec;
+
+    // A trace cut short by a crash just loses its last partial record
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        events.push_back(rec);
+    }
+
+    fclose(in);
+
+    return true;
+}
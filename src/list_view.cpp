@@ -0,0 +1,108 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "../include/list_view.h"
+
+list_view::list_view(int top, int row_height) {
+    this->top = top;
+    this->row_height = row_height;
+    this->num_entries = 0;
+    this->num_fit = 0;
+    this->first_entry = 0;
+    this->max_first = 0;
+}
+
+void list_view::resize(size_t num_entries, int height) {
+    this->num_entries = num_entries;
+    this->num_fit = height > 0 ? height / this->row_height : 0;
+
+    // Leave a little room below the last entry
+    this->max_first = num_entries + 2 > (size_t) this->num_fit ? num_entries + 2 - this->num_fit : 0;
+
+    // The list can shrink under us
+    if (this->first_entry > this->max_first) {
+        this->first_entry = this->max_first;
+    }
+}
+
+int list_view::scroll_by(int delta) {
+    size_t old_first = this->first_entry;
+
+    if (delta < 0) {
+        this->first_entry = (size_t) -delta < this->first_entry ? this->first_entry + delta : 0;
+    } else {
+        this->scroll_to(this->first_entry + delta);
+    }
+
+    return (int) (this->first_entry - old_first);
+}
+
+void list_view::scroll_to(size_t entry) {
+    this->first_entry = entry < this->max_first ? entry : this->max_first;
+}
+
+int list_view::screen_row_at(int y) const {
+    if (y < this->top) {
+        return -1;
+    }
+
+    int row = (y - this->top) / this->row_height;
+
+    return row < this->visible_rows() ? row : -1;
+}
+
+bool list_view::entry_at(int y, size_t * entry) const {
+    int row = this->screen_row_at(y);
+
+    if (row == -1) {
+        return false;
+    }
+
+    *entry = this->first_entry + row;
+
+    return true;
+}
+
+int list_view::row_top(int screen_row) const {
+    return this->top + screen_row * this->row_height;
+}
+
+int list_view::baseline(int screen_row) const {
+    return this->top + (screen_row + 1) * this->row_height;
+}
+
+size_t list_view::first() const {
+    return this->first_entry;
+}
+
+int list_view::visible_rows() const {
+    if (this->first_entry >= this->num_entries) {
+        return 0;
+    }
+
+    size_t left = this->num_entries - this->first_entry;
+
+    return left < (size_t) this->num_fit ? (int) left : this->num_fit;
+}
+
+int list_view::capacity() const {
+    return this->num_fit;
+}
+
+bool list_view::can_scroll() const {
+    return this->max_first > 0;
+}
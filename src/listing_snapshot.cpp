@@ -0,0 +1,464 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include "../include/listing_snapshot.h"
+#include "../include/name_sort.h"
+
+static const char SNAPSHOT_SUFFIX[] = ".snap";
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t) 7;
+}
+
+// FNV-1a, eight bytes at a time. Snapshots are tens of megabytes for the
+// directories that need them, so this has to keep up with reading the file.
+static uint64_t checksum(const char * const data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+
+    for (; i < len; i++) {
+        hash = (hash ^ (unsigned char) data[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Checks everything in a mapped snapshot of `path` that doesn't need the directory
+static bool is_valid(const char * const data, size_t size, const char * const path) {
+    if (size < sizeof(snapshot_header)) {
+        return false;
+    }
+
+    snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION || header.header_size != sizeof(snapshot_header)) {
+        return false;
+    }
+
+    // Each part is checked against what's left of the file before it's used, so
+    // that none of these can overflow
+    size_t left = size - sizeof(header);
+
+    if (header.path_len > PATH_MAX || pad8(header.path_len) > left) {
+        return false;
+    }
+
+    left -= pad8(header.path_len);
+
+    if (header.num_entries > left / sizeof(snapshot_entry)) {
+        return false;
+    }
+
+    left -= header.num_entries * sizeof(snapshot_entry);
+
+    if (header.names_size != left || header.names_size > UINT32_MAX) {
+        return false;
+    }
+
+    if (strlen(path) != header.path_len || memcmp(data + sizeof(header), path, header.path_len) != 0) {
+        return false;
+    }
+
+    return checksum(data + sizeof(header), size - sizeof(header)) == header.checksum;
+}
+
+listing_snapshots::listing_snapshots() {
+    const char * const enabled = getenv("FX_SNAPSHOTS");
+    const char * const cache_home = getenv("XDG_CACHE_HOME");
+    const char * const home = getenv("HOME");
+    int len = -1;
+
+    this->loaded = 0;
+    this->rejected = 0;
+    this->saved = 0;
+    this->stopping = false;
+    this->has_pending = false;
+    this->pending_path[0] = '\0';
+
+    if (enabled && strcmp(enabled, "0") == 0) {
+        len = -1;
+    } else if (cache_home && cache_home[0] == '/') {
+        len = snprintf(this->dir, sizeof(this->dir), "%s/fx", cache_home);
+    } else if (home && home[0] == '/') {
+        len = snprintf(this->dir, sizeof(this->dir), "%s/.cache/fx", home);
+    }
+
+    if (len < 0 || (size_t) len >= sizeof(this->dir) - 32) {
+        this->dir[0] = '\0';
+        this->dir_len = 0;
+
+        return;
+    }
+
+    this->dir_len = len;
+    this->writer = std::thread(&listing_snapshots::writer_loop, this);
+}
+
+listing_snapshots::~listing_snapshots() {
+    if (! this->writer.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+
+    this->wake.notify_one();
+    this->writer.join();
+}
+
+bool listing_snapshots::file_name(const char * const path, char (&buf)[PATH_MAX + 1]) const {
+    if (this->dir_len == 0) {
+        return false;
+    }
+
+    // Collisions are caught by the path stored in the file
+    int len = snprintf(buf, sizeof(buf), "%s/%016llx%s", this->dir, (unsigned long long) checksum(path, strlen(path)), SNAPSHOT_SUFFIX);
+
+    return len > 0 && (size_t) len < sizeof(buf);
+}
+
+bool listing_snapshots::load(const char * const path, dir_listing &listing) {
+    char name[PATH_MAX + 1];
+
+    if (! this->file_name(path, name)) {
+        return false;
+    }
+
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) == -1 || file_stat.st_size < (off_t) sizeof(snapshot_header)) {
+        close(fd);
+        unlink(name);
+        this->rejected++;
+
+        return false;
+    }
+
+    const size_t size = file_stat.st_size;
+    void * map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const char * const data = (const char *) map;
+    bool ok = is_valid(data, size, path);
+    snapshot_header header;
+    struct stat dir_stat;
+
+    memcpy(&header, data, sizeof(header));
+
+    // Last, since it's the only check that can change from one run to the next
+    ok = ok && stat(path, &dir_stat) == 0 &&
+        (uint64_t) dir_stat.st_dev == header.dev && (uint64_t) dir_stat.st_ino == header.ino &&
+        dir_stat.st_mtim.tv_sec == header.mtime_sec && dir_stat.st_mtim.tv_nsec == header.mtime_nsec;
+
+    const snapshot_entry * const entries = (const snapshot_entry *) (data + sizeof(header) + pad8(header.path_len));
+    const char * const names = (const char *) (entries + (ok ? header.num_entries : 0));
+
+    for (size_t i = 0; ok && i < header.num_entries; i++) {
+        snapshot_entry entry;
+
+        memcpy(&entry, entries + i, sizeof(entry));
+
+        if ((uint64_t) entry.name_offset + entry.len >= header.names_size || names[entry.name_offset + entry.len] != '\0') {
+            ok = false;
+            break;
+        }
+
+        // The listing has to come out sorted, or finding names in it won't work
+        if (i > 0 && name_cmp(listing.name(listing.at(i - 1)), listing.at(i - 1).len, names + entry.name_offset, entry.len) >= 0) {
+            ok = false;
+            break;
+        }
+
+        listing.add(names + entry.name_offset, entry.len, (entry.flags & ENTRY_SYMLINK) ? S_IFLNK : entry.mode & S_IFMT);
+
+        if (entry.meta == META_DONE) {
+            listing.set_meta(i, entry.mode, entry.uid, entry.gid);
+            listing.entry(i).meta = META_NONE;
+        }
+    }
+
+    munmap(map, size);
+
+    if (! ok) {
+        listing.clear();
+        unlink(name);
+        this->rejected++;
+
+        return false;
+    }
+
+    // Mark it as recently used, for `trim`
+    utimensat(AT_FDCWD, name, nullptr, 0);
+    this->loaded++;
+
+    return true;
+}
+
+void listing_snapshots::save(const char * const path, const dir_listing &listing, const struct stat &dir_stat) {
+    char name[PATH_MAX + 1];
+
+    if (listing.size() < SNAPSHOT_MIN_ENTRIES || ! this->file_name(path, name)) {
+        return;
+    }
+
+    snapshot_header header;
+
+    // Don't write the same thing again
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+    if (fd != -1) {
+        ssize_t bytes = read(fd, &header, sizeof(header));
+        close(fd);
+
+        if (bytes == sizeof(header) && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+            header.version == SNAPSHOT_VERSION && header.num_entries == listing.size() &&
+            header.dev == (uint64_t) dir_stat.st_dev && header.ino == (uint64_t) dir_stat.st_ino &&
+            header.mtime_sec == dir_stat.st_mtim.tv_sec && header.mtime_nsec == dir_stat.st_mtim.tv_nsec) {
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        // Anything still waiting from before is replaced; this is newer
+        this->pending.copy_from(listing);
+        memcpy(this->pending_path, path, strlen(path) + 1);
+        this->pending_stat = dir_stat;
+        this->has_pending = true;
+    }
+
+    this->wake.notify_one();
+}
+
+void listing_snapshots::writer_loop() {
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while (1) {
+        while (! this->stopping && ! this->has_pending) {
+            this->wake.wait(guard);
+        }
+
+        // Whatever is pending when fx exits still gets written
+        if (! this->has_pending) {
+            return;
+        }
+
+        char path[PATH_MAX + 1];
+        const struct stat dir_stat = this->pending_stat;
+
+        this->writing.swap(this->pending);
+        memcpy(path, this->pending_path, sizeof(path));
+        this->has_pending = false;
+
+        guard.unlock();
+        this->write_file(path, this->writing, dir_stat);
+        guard.lock();
+    }
+}
+
+void listing_snapshots::write_file(const char * const path, const dir_listing &listing, const struct stat &dir_stat) {
+    char name[PATH_MAX + 1];
+
+    if (! this->file_name(path, name)) {
+        return;
+    }
+
+    const size_t path_len = strlen(path);
+    size_t names_size = 0;
+
+    for (size_t row = 0; row < listing.size(); row++) {
+        names_size += listing.entry(listing.index_at(row)).len + 1;
+    }
+
+    if (names_size > UINT32_MAX) {
+        return;
+    }
+
+    snapshot_header header;
+    const size_t body_size = pad8(path_len) + listing.size() * sizeof(snapshot_entry) + names_size;
+    char * const buf = (char *) calloc(sizeof(header) + body_size, 1);
+
+    if (! buf) {
+        return;
+    }
+
+    char * const body = buf + sizeof(header);
+    snapshot_entry * const entries = (snapshot_entry *) (body + pad8(path_len));
+    char * const names = (char *) (entries + listing.size());
+    uint32_t name_offset = 0;
+
+    memcpy(body, path, path_len);
+
+    // Rows go in sorted order, with the names packed in the same order
+    for (size_t row = 0; row < listing.size(); row++) {
+        const uint32_t index = listing.index_at(row);
+        const path_segment &segment = listing.entry(index);
+        snapshot_entry &entry = entries[row];
+
+        entry.name_offset = name_offset;
+        entry.len = segment.len;
+        entry.mode = segment.mode;
+        entry.uid = segment.uid;
+        entry.gid = segment.gid;
+        entry.meta = segment.meta == META_DONE ? META_DONE : META_NONE;
+        entry.flags = listing.flags(index);
+
+        memcpy(names + name_offset, listing.name(segment), segment.len + 1);
+        name_offset += segment.len + 1;
+    }
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.dev = dir_stat.st_dev;
+    header.ino = dir_stat.st_ino;
+    header.mtime_sec = dir_stat.st_mtim.tv_sec;
+    header.mtime_nsec = dir_stat.st_mtim.tv_nsec;
+    header.path_len = path_len;
+    header.num_entries = listing.size();
+    header.names_size = names_size;
+    header.checksum = checksum(body, body_size);
+    memcpy(buf, &header, sizeof(header));
+
+    // Neither the cache directory nor ~/.cache have to exist yet
+    char parent[PATH_MAX + 1];
+
+    memcpy(parent, this->dir, this->dir_len + 1);
+    *strrchr(parent, '/') = '\0';
+    mkdir(parent, 0700);
+    mkdir(this->dir, 0700);
+
+    // Another fx could be saving the same directory
+    char tmp_name[PATH_MAX + 1];
+    int tmp_len = snprintf(tmp_name, sizeof(tmp_name), "%s.%d.tmp", name, getpid());
+
+    if (tmp_len < 0 || (size_t) tmp_len >= sizeof(tmp_name)) {
+        free(buf);
+        return;
+    }
+
+    int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (fd == -1) {
+        free(buf);
+        return;
+    }
+
+    const size_t total = sizeof(header) + body_size;
+    size_t written = 0;
+
+    while (written < total) {
+        ssize_t bytes = write(fd, buf + written, total - written);
+
+        if (bytes <= 0) {
+            break;
+        }
+
+        written += bytes;
+    }
+
+    free(buf);
+
+    if (close(fd) == -1 || written != total || rename(tmp_name, name) == -1) {
+        unlink(tmp_name);
+        return;
+    }
+
+    this->saved++;
+    this->trim();
+}
+
+void listing_snapshots::trim() {
+    struct file {
+        char name[NAME_MAX + 1];
+        struct timespec used;
+    };
+
+    DIR * dir = opendir(this->dir);
+
+    if (! dir) {
+        return;
+    }
+
+    std::vector<file> files;
+    struct dirent * entry;
+
+    while ((entry = readdir(dir)) != nullptr) {
+        const size_t len = strlen(entry->d_name);
+        struct stat st;
+
+        if (len < sizeof(SNAPSHOT_SUFFIX) || strcmp(entry->d_name + len - (sizeof(SNAPSHOT_SUFFIX) - 1), SNAPSHOT_SUFFIX) != 0) {
+            continue;
+        }
+
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0) {
+            file f;
+
+            memcpy(f.name, entry->d_name, len + 1);
+            f.used = st.st_mtim;
+            files.push_back(f);
+        }
+    }
+
+    while (files.size() > SNAPSHOT_MAX_FILES) {
+        size_t oldest = 0;
+
+        for (size_t i = 1; i < files.size(); i++) {
+            const struct timespec &a = files[i].used;
+            const struct timespec &b = files[oldest].used;
+
+            if (a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec)) {
+                oldest = i;
+            }
+        }
+
+        unlinkat(dirfd(dir), files[oldest].name, 0);
+        files[oldest] = files.back();
+        files.pop_back();
+    }
+
+    closedir(dir);
+}
@@ -15,10 +15,19 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with fx.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xos.h>
+#include "../include/event_trace.h"
+#include "../include/resident.h"
+#include "../include/util.h"
 #include "../include/window_context.h"
 
 const char * const EXIT_CODES[] = {
@@ -27,36 +36,223 @@ const char * const EXIT_CODES[] = {
     "This should never be printed!",
 };
 
-int main(int argc, char ** argv) {
-    window_context ctx(0, 0, 500, 500, "fx");
+// Set by SIGINT and SIGTERM in a resident fx, so that it cleans up its socket
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+int handle_event(window_context &ctx, XEvent &event) {
+    switch (event.type) {
+        case Expose:
+            if (event.xexpose.count == 0) {
+                return ctx.on_expose(event.xexpose);
+            }
+
+            return NO_EXIT;
+        case ButtonPress:
+            return ctx.on_button_press(event.xbutton);
+        case KeyPress:
+            return ctx.on_key_press(event.xkey);
+        case MotionNotify:
+            return ctx.on_motion(event.xmotion);
+        case ConfigureNotify:
+            return ctx.on_configure(event.xconfigure);
+        case MappingNotify:
+            return ctx.on_mapping(event.xmapping);
+        case ClientMessage:
+            return ctx.on_client_message(event.xclient);
+        default:
+            return ctx.on_other_event(event);
+    }
+}
+
+// Writes what fx prints when it closes with `retval`
+static size_t format_result(window_context &ctx, int retval, char * const buf, size_t buf_size) {
+    int len;
+
+    if (retval == USER_CD_EXIT_CODE) {
+        len = snprintf(buf, buf_size, "cd %s\n", ctx.get_cd_target());
+    } else {
+        len = snprintf(buf, buf_size, "Exit: %s\n", EXIT_CODES[retval]);
+    }
+
+    return (size_t) len < buf_size ? len : buf_size - 1;
+}
+
+// Runs fx until the window closes. With `listen_fd` set, fx is resident instead:
+// the window is shown for each client that connects and hidden again when it
+// closes, and this only returns when fx is told to stop.
+static int run(window_context &ctx, int listen_fd) {
+    // Records what's handled below when FX_TRACE is set
+    trace_writer trace(getenv("FX_TRACE"));
     XEvent event;
-    int retval;
+    int retval = NO_EXIT;
+    // The resident fx's current client, or -1. poll skips negative fds.
+    int client_fd = -1;
+
+    // The signal mask to wait with, which lets a resident fx be stopped
+    sigset_t wait_mask;
+    pthread_sigmask(SIG_SETMASK, nullptr, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    pollfd fds[8];
+    fds[0].fd = ConnectionNumber(ctx.dis);
+    fds[0].events = POLLIN;
+    fds[1].fd = ctx.load_fd();
+    fds[1].events = POLLIN;
+    fds[2].fd = ctx.cache_fd();
+    fds[2].events = POLLIN;
+    fds[3].fd = ctx.search_fd();
+    fds[3].events = POLLIN;
+    fds[4].fd = ctx.size_fd();
+    fds[4].events = POLLIN;
+    fds[5].events = POLLIN;
+    fds[6].events = POLLIN;
+    fds[7].fd = ctx.prefetch_fd();
+    fds[7].events = POLLIN;
 
     while(1) {
-        XNextEvent(ctx.dis, &event);
+        // Handle everything that's queued before drawing anything. The handlers only
+        // record what changed, so a burst of events costs one frame. XPending also
+        // flushes whatever the last frame drew.
+        while (XPending(ctx.dis) != 0) {
+            XNextEvent(ctx.dis, &event);
+
+            // Motion events that are already queued behind this one replace it
+            if (event.type == MotionNotify) {
+                while (XCheckTypedWindowEvent(ctx.dis, event.xmotion.window, MotionNotify, &event));
+            }
+
+            trace.record(event);
+            retval = handle_event(ctx, event);
+
+            if (! retval) {
+                continue;
+            }
+
+            char result[PATH_MAX + 64];
+            const size_t len = format_result(ctx, retval, result, sizeof(result));
+
+            if (listen_fd == -1) {
+                fwrite(result, 1, len, stdout);
 
-        if (event.type == Expose && event.xexpose.count == 0) {
-            retval = ctx.on_expose(event.xexpose);
+                return 0;
+            }
+
+            // The session is over, but everything it loaded stays
+            if (client_fd != -1) {
+                finish_resident_client(client_fd, result, len);
+                client_fd = -1;
+                ctx.hide();
+            }
         }
 
-        if (event.type == ButtonPress) {
-            retval = ctx.on_button_press(event.xbutton);
+        fds[5].fd = listen_fd;
+        fds[6].fd = client_fd;
+
+        if (stop_requested) {
+            return 0;
         }
 
-        if (event.type == KeyPress) {
-            retval = ctx.on_key_press(event.xkey);
+        const int timeout_ms = ctx.next_timeout();
+        const timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+        // Wait for more input, the next frame, or the live update delay. A resident
+        // fx has SIGINT and SIGTERM blocked everywhere but here, so one that comes
+        // in while events are handled is still noticed.
+        if (ppoll(fds, c_arr_size(fds), timeout_ms < 0 ? nullptr : &timeout, &wait_mask) == -1) {
+            continue;
         }
 
-        if (event.type == MotionNotify) {
-            retval = ctx.on_motion(event.xmotion);
+        if (fds[1].revents & POLLIN) {
+            ctx.on_load_progress();
         }
 
-        if (retval) {
-            if (retval != USER_CD_EXIT_CODE) {
-                printf("Exit: %s\n", EXIT_CODES[retval]);
+        if (fds[2].revents & POLLIN) {
+            ctx.on_cache_event();
+        }
+
+        if (fds[3].revents & POLLIN) {
+            ctx.on_search_progress();
+        }
+
+        if (fds[4].revents & POLLIN) {
+            ctx.on_size_progress();
+        }
+
+        if (fds[7].revents & POLLIN) {
+            ctx.on_prefetch_progress();
+        }
+
+        if ((fds[5].revents & POLLIN) && client_fd != -1) {
+            // There's only one window, so anyone else gets to open their own
+            refuse_resident_client(listen_fd);
+        } else if (fds[5].revents & POLLIN) {
+            char cwd[PATH_MAX + 1];
+
+            client_fd = accept_resident_client(listen_fd, cwd);
+
+            if (client_fd != -1) {
+                ctx.open(cwd);
             }
+        }
 
-            return 0;
+        if (fds[6].revents & (POLLIN | POLLHUP | POLLERR)) {
+            // The client sends nothing after its directory, so this means it went
+            // away, e.g. the shell it ran in was closed
+            close(client_fd);
+            client_fd = -1;
+            ctx.hide();
+        }
+
+        ctx.on_timer();
+    }
+}
+
+int main(int argc, char ** argv) {
+    const bool resident = argc > 1 && strcmp(argv[1], "--daemon") == 0;
+
+    if (! resident) {
+        // A resident fx has its window ready and its caches warm
+        int fd = connect_resident();
+
+        const int status = fd == -1 ? -1 : run_resident_client(fd);
+
+        if (status != -1) {
+            return status;
         }
     }
+
+    if (resident) {
+        // Only `run` takes these, while it waits. This comes before any threads are
+        // started so that they inherit the mask and none of them takes the signal.
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_stop;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    window_context ctx(0, 0, 500, 500, "fx");
+
+    if (! resident) {
+        ctx.show();
+
+        return run(ctx, -1);
+    }
+
+    int listen_fd = listen_resident();
+    int retval = run(ctx, listen_fd);
+    close_resident(listen_fd);
+
+    return retval;
 }
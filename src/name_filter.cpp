@@ -0,0 +1,323 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../include/name_filter.h"
+#include "../include/util.h"
+
+// Lowercases ASCII letters. Names aren't necessarily UTF-8, so every other byte is
+// compared as is.
+static inline char fold(char c) {
+    return (unsigned char) (c - 'A') < 26 ? c | 0x20 : c;
+}
+
+static bool equal_folded(const char * const str, const char * const query, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (fold(str[i]) != query[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline bool test_bit(const uint64_t * const bits, size_t i) {
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t * const bits, size_t i) {
+    bits[i / 64] |= 1ull << (i % 64);
+}
+
+static inline void clear_bit(uint64_t * const bits, size_t i) {
+    bits[i / 64] &= ~(1ull << (i % 64));
+}
+
+name_filter::name_filter() {
+    this->query[0] = '\0';
+    this->query_len = 0;
+    this->rows = nullptr;
+    this->num_rows = 0;
+    this->rows_cap = 0;
+    this->hits = nullptr;
+    this->found = nullptr;
+    this->hits_cap = 0;
+}
+
+name_filter::~name_filter() {
+    free(this->rows);
+    free(this->hits);
+    free(this->found);
+}
+
+void name_filter::set_query(const dir_listing &listing, const char * const query, size_t len) {
+    if (len > NAME_MAX) {
+        len = NAME_MAX;
+    }
+
+    const bool narrower = this->query_len != 0 && len > this->query_len && equal_folded(query, this->query, this->query_len);
+
+    for (size_t i = 0; i < len; i++) {
+        this->query[i] = fold(query[i]);
+    }
+
+    this->query[len] = '\0';
+    this->query_len = len;
+
+    if (len == 0) {
+        this->num_rows = 0;
+    } else if (narrower) {
+        this->refine(listing);
+    } else {
+        this->match_all(listing);
+    }
+}
+
+void name_filter::rematch(const dir_listing &listing) {
+    if (this->query_len != 0) {
+        this->match_all(listing);
+    }
+}
+
+bool name_filter::active() const {
+    return this->query_len != 0;
+}
+
+size_t name_filter::size() const {
+    return this->num_rows;
+}
+
+size_t name_filter::row(size_t i) const {
+    return this->rows[i];
+}
+
+size_t name_filter::position_of(size_t row) const {
+    size_t lo = 0;
+    size_t hi = this->num_rows;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (this->rows[mid] < row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+void name_filter::reserve(const dir_listing &listing) {
+    const size_t words = (listing.num_entries() + 63) / 64;
+
+    if (words > this->hits_cap) {
+        uint64_t * new_hits = (uint64_t *) realloc(this->hits, words * sizeof(uint64_t));
+        check_error(new_hits, (uint64_t *) nullptr);
+        this->hits = new_hits;
+
+        uint64_t * new_found = (uint64_t *) realloc(this->found, words * sizeof(uint64_t));
+        check_error(new_found, (uint64_t *) nullptr);
+        this->found = new_found;
+
+        this->hits_cap = words;
+    }
+
+    if (listing.size() > this->rows_cap) {
+        uint32_t * new_rows = (uint32_t *) realloc(this->rows, listing.size() * sizeof(uint32_t));
+        check_error(new_rows, (uint32_t *) nullptr);
+
+        this->rows = new_rows;
+        this->rows_cap = listing.size();
+    }
+}
+
+void name_filter::match_all(const dir_listing &listing) {
+    this->reserve(listing);
+    memset(this->hits, 0, ((listing.num_entries() + 63) / 64) * sizeof(uint64_t));
+    this->scan_pool(listing, this->hits);
+    this->collect_rows(listing);
+}
+
+void name_filter::refine(const dir_listing &listing) {
+    const size_t num_entries = listing.num_entries();
+
+    if (this->num_rows * FILTER_SCAN_RATIO < num_entries) {
+        // Few enough matches that it's cheaper to visit them in sorted order, even
+        // though their names are all over the pool
+        const char * const pool = listing.name_pool();
+        const size_t pool_size = listing.name_pool_size();
+        size_t kept = 0;
+
+        for (size_t i = 0; i < this->num_rows; i++) {
+            const uint32_t index = listing.index_at(this->rows[i]);
+            const path_segment &path = listing.entry(index);
+
+            if (this->find(pool + path.name_offset, path.len, pool_size - path.name_offset)) {
+                this->rows[kept++] = this->rows[i];
+            } else {
+                clear_bit(this->hits, index);
+            }
+        }
+
+        this->num_rows = kept;
+
+        return;
+    }
+
+    // Otherwise go through the pool front to back, and keep what matched both times
+    const size_t words = (num_entries + 63) / 64;
+
+    memset(this->found, 0, words * sizeof(uint64_t));
+    this->scan_pool(listing, this->found);
+
+    for (size_t i = 0; i < words; i++) {
+        this->hits[i] &= this->found[i];
+    }
+
+    this->narrow_rows(listing);
+}
+
+void name_filter::scan_pool(const dir_listing &listing, uint64_t * const bits) const {
+    // The pool holds the names back to back in load order, each followed by a null,
+    // so the number of nulls before a match says which entry it's in. The query has
+    // no null bytes, so a match can't run from one name into the next.
+    const char * const pool = listing.name_pool();
+    const size_t pool_size = listing.name_pool_size();
+    const size_t n = this->query_len;
+    size_t index = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // The same test as in `find`, with the nulls in each 16 bytes counted alongside
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i first = _mm_set1_epi8(this->query[0] | 0x20);
+    const __m128i last = _mm_set1_epi8(this->query[n - 1] | 0x20);
+
+    for (; i + n - 1 + 16 <= pool_size; i += 16) {
+        const __m128i raw = _mm_loadu_si128((const __m128i *) (pool + i));
+        const __m128i a = _mm_or_si128(raw, case_bit);
+        const __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *) (pool + i + n - 1)), case_bit);
+        const unsigned int nulls = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, zero));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            const int bit = __builtin_ctz(mask);
+            const size_t match_index = index + __builtin_popcount(nulls & ((1u << bit) - 1));
+
+            // One match per name is enough
+            if (! test_bit(bits, match_index) && equal_folded(pool + i + bit, this->query, n)) {
+                set_bit(bits, match_index);
+            }
+
+            mask &= mask - 1;
+        }
+
+        index += __builtin_popcount(nulls);
+    }
+#endif
+
+    for (; i + n <= pool_size; i++) {
+        if (pool[i] == '\0') {
+            index++;
+        } else if (! test_bit(bits, index) && fold(pool[i]) == this->query[0] && equal_folded(pool + i, this->query, n)) {
+            set_bit(bits, index);
+        }
+    }
+}
+
+void name_filter::collect_rows(const dir_listing &listing) {
+    // Removed entries are in the pool but not in the sorted order, so they drop out here
+    const uint32_t * const order = listing.sorted_indices();
+    const size_t size = listing.size();
+    size_t count = 0;
+
+    for (size_t row = 0; row < size; row++) {
+        this->rows[count] = row;
+        count += test_bit(this->hits, order[row]);
+    }
+
+    this->num_rows = count;
+}
+
+void name_filter::narrow_rows(const dir_listing &listing) {
+    const uint32_t * const order = listing.sorted_indices();
+    size_t kept = 0;
+
+    for (size_t i = 0; i < this->num_rows; i++) {
+        const uint32_t row = this->rows[i];
+
+        this->rows[kept] = row;
+        kept += test_bit(this->hits, order[row]);
+    }
+
+    this->num_rows = kept;
+}
+
+const char * name_filter::find(const char * const str, size_t len, size_t avail) const {
+    const size_t n = this->query_len;
+    size_t i = 0;
+
+    if (n > len) {
+        return nullptr;
+    }
+
+#ifdef __SSE2__
+    // Test 16 starting positions at a time against the first and last byte of the
+    // query, then check the few positions where both match. Setting 0x20 folds the
+    // case of letters; the check weeds out the other bytes that it makes equal.
+    // Names are short, so the loads may run past the end of the name into the rest
+    // of the pool, and the positions past the end are masked off.
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i first = _mm_set1_epi8(this->query[0] | 0x20);
+    const __m128i last = _mm_set1_epi8(this->query[n - 1] | 0x20);
+
+    for (; i + n <= len && i + n - 1 + 16 <= avail; i += 16) {
+        const __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *) (str + i)), case_bit);
+        const __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *) (str + i + n - 1)), case_bit);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        const size_t starts = len - n + 1 - i;
+
+        if (starts < 16) {
+            mask &= (1u << starts) - 1;
+        }
+
+        while (mask) {
+            const char * const candidate = str + i + __builtin_ctz(mask);
+
+            if (equal_folded(candidate, this->query, n)) {
+                return candidate;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i + n <= len; i++) {
+        if (fold(str[i]) == this->query[0] && equal_folded(str + i, this->query, n)) {
+            return str + i;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,227 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "../include/name_sort.h"
+
+// Ranges this short are insertion sorted
+const size_t INSERTION_SORT_MAX = 16;
+
+static inline uint64_t load_be64(const char * const p) {
+    uint64_t val;
+
+    memcpy(&val, p, sizeof(val));
+
+    return __builtin_bswap64(val);
+}
+
+uint64_t name_prefix(const char * const name, size_t len) {
+    if (len >= 8) {
+        return load_be64(name);
+    }
+
+    char buf[8] = { 0 };
+    memcpy(buf, name, len);
+
+    return load_be64(buf);
+}
+
+int name_cmp(const char * const a, size_t a_len, const char * const b, size_t b_len) {
+    size_t len = a_len <= b_len ? a_len : b_len;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a_word = load_be64(a + i);
+        uint64_t b_word = load_be64(b + i);
+
+        if (a_word != b_word) {
+            return a_word < b_word ? -1 : 1;
+        }
+    }
+
+    for (; i < len; i++) {
+        unsigned char a_char = a[i];
+        unsigned char b_char = b[i];
+
+        if (a_char != b_char) {
+            return a_char < b_char ? -1 : 1;
+        }
+    }
+
+    if (a_len < b_len) {
+        return -1;
+    } else if (a_len > b_len) {
+        return 1;
+    }
+
+    // This should never be possible for filenames in the same directory
+    return 0;
+}
+
+static inline int key_cmp(const sort_key &a, const sort_key &b, const char * const names) {
+    if (a.prefix != b.prefix) {
+        return a.prefix < b.prefix ? -1 : 1;
+    }
+
+    // Names can't contain null bytes, so a zero in the last byte of the prefix means
+    // the name is shorter than 8 bytes. The prefixes match, so then both names are the
+    // same. Otherwise both names are at least 8 bytes and we can skip the part we've
+    // already compared.
+    if ((a.prefix & 0xff) == 0) {
+        return 0;
+    }
+
+    return strcmp(names + a.name_offset + 8, names + b.name_offset + 8);
+}
+
+static void insertion_sort(sort_key * const a, size_t count, const char * const names) {
+    for (size_t i = 1; i < count; i++) {
+        sort_key key = a[i];
+        size_t j = i;
+
+        while (j > 0 && key_cmp(key, a[j - 1], names) < 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+
+        a[j] = key;
+    }
+}
+
+static void sift_down(sort_key * const a, size_t root, size_t count, const char * const names) {
+    sort_key key = a[root];
+
+    while (2 * root + 1 < count) {
+        size_t child = 2 * root + 1;
+
+        if (child + 1 < count && key_cmp(a[child], a[child + 1], names) < 0) {
+            child++;
+        }
+
+        if (key_cmp(key, a[child], names) >= 0) {
+            break;
+        }
+
+        a[root] = a[child];
+        root = child;
+    }
+
+    a[root] = key;
+}
+
+static void heapsort(sort_key * const a, size_t count, const char * const names) {
+    for (size_t i = count / 2; i > 0; i--) {
+        sift_down(a, i - 1, count, names);
+    }
+
+    for (size_t end = count - 1; end > 0; end--) {
+        sort_key tmp = a[0];
+        a[0] = a[end];
+        a[end] = tmp;
+
+        sift_down(a, 0, end, names);
+    }
+}
+
+static inline void swap_keys(sort_key * const a, size_t i, size_t j) {
+    sort_key tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+// Moves the median of the first, middle and last keys to the front, where it
+// becomes the pivot
+static void median_to_front(sort_key * const a, size_t count, const char * const names) {
+    size_t mid = count / 2;
+    size_t last = count - 1;
+
+    if (key_cmp(a[mid], a[0], names) < 0) {
+        swap_keys(a, mid, 0);
+    }
+
+    if (key_cmp(a[last], a[mid], names) < 0) {
+        swap_keys(a, last, mid);
+
+        if (key_cmp(a[mid], a[0], names) < 0) {
+            swap_keys(a, mid, 0);
+        }
+    }
+
+    swap_keys(a, 0, mid);
+}
+
+// Hoare's partitioning scheme with the pivot at the front. Returns j such that
+// every key in [0, j] is <= every key in (j, count), with j < count - 1.
+static size_t partition(sort_key * const a, size_t count, const char * const names) {
+    const sort_key pivot = a[0];
+    ptrdiff_t i = -1;
+    ptrdiff_t j = count;
+
+    while (1) {
+        do {
+            i++;
+        } while (key_cmp(a[i], pivot, names) < 0);
+
+        do {
+            j--;
+        } while (key_cmp(a[j], pivot, names) > 0);
+
+        if (i >= j) {
+            return j;
+        }
+
+        swap_keys(a, i, j);
+    }
+}
+
+static void introsort(sort_key * a, size_t count, int depth_limit, const char * const names) {
+    while (count > INSERTION_SORT_MAX) {
+        if (depth_limit == 0) {
+            heapsort(a, count, names);
+            return;
+        }
+
+        depth_limit--;
+        median_to_front(a, count, names);
+
+        size_t left = partition(a, count, names) + 1;
+        size_t right = count - left;
+
+        // Recurse into the smaller half and loop on the bigger one so that the stack
+        // stays O(log n) deep
+        if (left < right) {
+            introsort(a, left, depth_limit, names);
+            a += left;
+            count = right;
+        } else {
+            introsort(a + left, right, depth_limit, names);
+            count = left;
+        }
+    }
+
+    insertion_sort(a, count, names);
+}
+
+void sort_keys(sort_key * const keys, size_t count, const char * const names) {
+    int depth_limit = 0;
+
+    for (size_t n = count; n > 1; n >>= 1) {
+        depth_limit += 2;
+    }
+
+    introsort(keys, count, depth_limit, names);
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "../include/nav_history.h"
+#include "../include/util.h"
+
+// Adds a copy of `path` to the newest end of `entries`, dropping the oldest entry
+// if it's full
+static void push_entry(std::deque<history_entry> &entries, const char * const path, size_t top) {
+    char * copy = strdup(path);
+    check_error(copy, (char *) nullptr);
+
+    if (entries.size() == HISTORY_MAX_ENTRIES) {
+        free(entries.front().path);
+        entries.pop_front();
+    }
+
+    entries.push_back({ copy, top });
+}
+
+static void clear_entries(std::deque<history_entry> &entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        free(entries[i].path);
+    }
+
+    entries.clear();
+}
+
+nav_history::nav_history() {
+    this->last.path = nullptr;
+    this->last.top = 0;
+}
+
+nav_history::~nav_history() {
+    this->clear();
+}
+
+void nav_history::push(const char * const path, size_t top) {
+    push_entry(this->back_entries, path, top);
+    clear_entries(this->forward_entries);
+}
+
+const history_entry * nav_history::back(const char * const path, size_t top) {
+    return this->step(this->back_entries, this->forward_entries, path, top);
+}
+
+const history_entry * nav_history::forward(const char * const path, size_t top) {
+    return this->step(this->forward_entries, this->back_entries, path, top);
+}
+
+const history_entry * nav_history::step(std::deque<history_entry> &from, std::deque<history_entry> &to, const char * const path, size_t top) {
+    if (from.empty()) {
+        return nullptr;
+    }
+
+    push_entry(to, path, top);
+    free(this->last.path);
+    this->last = from.back();
+    from.pop_back();
+
+    return &this->last;
+}
+
+void nav_history::drop_last(const char * const path) {
+    if (! this->back_entries.empty() && strcmp(this->back_entries.back().path, path) == 0) {
+        free(this->back_entries.back().path);
+        this->back_entries.pop_back();
+    }
+}
+
+size_t nav_history::position_of(const char * const path) const {
+    // The most recent visit wins, and that's at the newest end of the back stack
+    for (size_t i = this->back_entries.size(); i-- > 0; ) {
+        if (strcmp(this->back_entries[i].path, path) == 0) {
+            return this->back_entries[i].top;
+        }
+    }
+
+    for (size_t i = this->forward_entries.size(); i-- > 0; ) {
+        if (strcmp(this->forward_entries[i].path, path) == 0) {
+            return this->forward_entries[i].top;
+        }
+    }
+
+    return 0;
+}
+
+void nav_history::clear() {
+    clear_entries(this->back_entries);
+    clear_entries(this->forward_entries);
+    free(this->last.path);
+    this->last.path = nullptr;
+}
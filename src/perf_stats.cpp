@@ -0,0 +1,150 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "../include/perf_stats.h"
+
+perf_histogram::perf_histogram() {
+    this->reset();
+}
+
+void perf_histogram::record(unsigned long long ns) {
+    const uint64_t us = ns / 1000;
+    // Number of bits needed for `us`, so 0 goes in bucket 0, 1 in bucket 1, 2-3 in 2...
+    size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    if (bucket >= PERF_BUCKETS) {
+        bucket = PERF_BUCKETS - 1;
+    }
+
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    this->num_samples.fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t old_max = this->max.load(std::memory_order_relaxed);
+
+    while (ns > old_max && ! this->max.compare_exchange_weak(old_max, ns, std::memory_order_relaxed));
+}
+
+void perf_histogram::reset() {
+    for (size_t i = 0; i < PERF_BUCKETS; i++) {
+        this->buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    this->num_samples.store(0, std::memory_order_relaxed);
+    this->total.store(0, std::memory_order_relaxed);
+    this->max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t perf_histogram::count() const {
+    return this->num_samples.load(std::memory_order_relaxed);
+}
+
+uint64_t perf_histogram::total_ns() const {
+    return this->total.load(std::memory_order_relaxed);
+}
+
+uint64_t perf_histogram::percentile(unsigned int p) const {
+    const uint64_t count = this->count();
+    // Rank of the sample we're after, counting from 1
+    const uint64_t rank = (count * p + 99) / 100;
+    uint64_t seen = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < PERF_BUCKETS - 1; i++) {
+        seen += this->buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+            const uint64_t upper = (1ull << i) * 1000;
+            const uint64_t max = this->max.load(std::memory_order_relaxed);
+
+            // The slowest sample is a tighter bound than the bucket edge
+            return upper < max ? upper : max;
+        }
+    }
+
+    return this->max.load(std::memory_order_relaxed);
+}
+
+int perf_histogram::summarize(char * const buf, size_t buf_size, const char * const label) const {
+    char total[16];
+    char p50[16];
+    char p99[16];
+    char max[16];
+
+    format_ns(total, sizeof(total), this->total_ns());
+    format_ns(p50, sizeof(p50), this->percentile(50));
+    format_ns(p99, sizeof(p99), this->percentile(99));
+    format_ns(max, sizeof(max), this->max.load(std::memory_order_relaxed));
+
+    return snprintf(
+        buf, buf_size, "%-8s %6llu in %-7s p50 %-7s p99 %-7s max %s",
+        label, (unsigned long long) this->count(), total, p50, p99, max
+    );
+}
+
+void perf_histogram::dump(FILE * out, const char * const label) const {
+    char line[128];
+    char upper[16];
+
+    this->summarize(line, sizeof(line), label);
+    fprintf(out, "%s\n", line);
+
+    for (size_t i = 0; i < PERF_BUCKETS; i++) {
+        const uint64_t count = this->buckets[i].load(std::memory_order_relaxed);
+
+        if (count == 0) {
+            continue;
+        }
+
+        if (i == PERF_BUCKETS - 1) {
+            snprintf(upper, sizeof(upper), "more");
+        } else {
+            format_ns(upper, sizeof(upper), (1ull << i) * 1000);
+        }
+
+        fprintf(out, "    < %-8s %llu\n", upper, (unsigned long long) count);
+    }
+}
+
+perf_stats::perf_stats() {
+    this->enabled = false;
+    this->navigate_ns = 0;
+    this->load_ns = 0;
+}
+
+void perf_stats::reset() {
+    this->readdir.reset();
+    this->stat.reset();
+    this->sort.reset();
+    this->navigate_ns = perf_now_ns();
+    this->load_ns = 0;
+}
+
+int format_ns(char * const buf, size_t buf_size, uint64_t ns) {
+    if (ns < 1000) {
+        return snprintf(buf, buf_size, "%lluns", (unsigned long long) ns);
+    } else if (ns < 1000000) {
+        return snprintf(buf, buf_size, "%lluus", (unsigned long long) ns / 1000);
+    } else if (ns < 1000000000) {
+        return snprintf(buf, buf_size, "%.1fms", ns / 1e6);
+    }
+
+    return snprintf(buf, buf_size, "%.2fs", ns / 1e9);
+}
@@ -0,0 +1,249 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../include/resident.h"
+#include "../include/util.h"
+
+// Returns false if there's no display to be resident on, or the path doesn't fit
+static bool resident_path(sockaddr_un &addr) {
+    const char * const display = getenv("DISPLAY");
+    const char * const dir = getenv("XDG_RUNTIME_DIR");
+    char name[64];
+    size_t name_len = 0;
+
+    if (! display || display[0] == '\0') {
+        return false;
+    }
+
+    // Display names can have slashes in them, which would point somewhere else
+    for (; display[name_len] != '\0' && name_len < sizeof(name) - 1; name_len++) {
+        name[name_len] = display[name_len] == '/' ? '_' : display[name_len];
+    }
+
+    name[name_len] = '\0';
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    int len;
+
+    if (dir && dir[0] != '\0') {
+        len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/fx-%s.sock", dir, name);
+    } else {
+        len = snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/fx-%u-%s.sock", getuid(), name);
+    }
+
+    return len > 0 && (size_t) len < sizeof(addr.sun_path);
+}
+
+// Anyone can create a socket in /tmp, so both ends check that the other is the
+// same user. The client runs whatever the resident fx sends back.
+static bool is_same_user(int fd) {
+    ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        return false;
+    }
+
+    return cred.uid == getuid();
+}
+
+static bool send_all(int fd, const char * buf, size_t len) {
+    while (len != 0) {
+        // The other end going away shouldn't kill this one
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+
+        if (sent <= 0) {
+            return false;
+        }
+
+        buf += sent;
+        len -= sent;
+    }
+
+    return true;
+}
+
+int connect_resident() {
+    sockaddr_un addr;
+
+    if (! resident_path(addr)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check_error(fd, -1);
+
+    if (connect(fd, (sockaddr *) &addr, sizeof(addr)) == -1 || ! is_same_user(fd)) {
+        close(fd);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+int run_resident_client(int fd) {
+    char cwd[PATH_MAX + 1];
+    char * retval = getcwd(cwd, sizeof(cwd));
+    check_error(retval, (char *) NULL);
+
+    // The terminating null marks the end of the request. A busy resident fx doesn't
+    // wait for it, so the reply may already be in even if this fails.
+    send_all(fd, cwd, strlen(cwd) + 1);
+
+    // Nothing is printed until the whole reply is in, since it might say that the
+    // resident fx is busy
+    char buf[PATH_MAX + 64];
+    ssize_t len;
+    size_t total = 0;
+
+    while (total < sizeof(buf) && (len = read(fd, buf + total, sizeof(buf) - total)) > 0) {
+        total += len;
+    }
+
+    close(fd);
+
+    if (total == sizeof(RESIDENT_BUSY) - 1 && memcmp(buf, RESIDENT_BUSY, total) == 0) {
+        return -1;
+    }
+
+    // The resident fx always says why the window closed
+    if (total == 0) {
+        fprintf(stderr, "Lost the connection to the resident fx\n");
+
+        return 1;
+    }
+
+    fwrite(buf, 1, total, stdout);
+
+    return 0;
+}
+
+int listen_resident() {
+    sockaddr_un addr;
+
+    if (! resident_path(addr)) {
+        fprintf(stderr, "Can't be resident without a display\n");
+
+        throw EINVAL;
+    }
+
+    int existing = connect_resident();
+
+    if (existing != -1) {
+        close(existing);
+        fprintf(stderr, "fx is already resident on this display\n");
+
+        throw EADDRINUSE;
+    }
+
+    // Left over from a resident fx that didn't exit cleanly
+    unlink(addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check_error(fd, -1);
+
+    const mode_t old_mask = umask(0077);
+    int retval = bind(fd, (sockaddr *) &addr, sizeof(addr));
+    umask(old_mask);
+
+    check_error(retval, -1);
+    check_error(listen(fd, 4), -1);
+
+    return fd;
+}
+
+int accept_resident_client(int listen_fd, char (&cwd)[PATH_MAX + 1]) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t len = 0;
+
+    while (is_same_user(fd)) {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, RESIDENT_REQUEST_TIMEOUT_MS) != 1) {
+            break;
+        }
+
+        ssize_t got = read(fd, cwd + len, sizeof(cwd) - len);
+
+        if (got <= 0) {
+            break;
+        }
+
+        len += got;
+
+        if (cwd[len - 1] == '\0') {
+            if (cwd[0] == '/') {
+                return fd;
+            }
+
+            break;
+        }
+
+        if (len == sizeof(cwd)) {
+            break;
+        }
+    }
+
+    close(fd);
+
+    return -1;
+}
+
+void refuse_resident_client(int listen_fd) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+        return;
+    }
+
+    // The client reads this even if its directory arrives after the close
+    send_all(fd, RESIDENT_BUSY, sizeof(RESIDENT_BUSY) - 1);
+    close(fd);
+}
+
+void finish_resident_client(int fd, const char * const result, size_t len) {
+    send_all(fd, result, len);
+    close(fd);
+}
+
+void close_resident(int listen_fd) {
+    sockaddr_un addr;
+
+    close(listen_fd);
+
+    if (resident_path(addr)) {
+        unlink(addr.sun_path);
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "../include/stat_pool.h"
+
+stat_pool::stat_pool(unsigned int num_threads) {
+    this->num_threads = num_threads;
+    this->job_id = 0;
+    this->busy = 0;
+    this->stopping = false;
+    this->job_reader = nullptr;
+    this->job_listing = nullptr;
+    this->next = 0;
+    this->job_end = 0;
+    this->threads = new std::thread[num_threads];
+
+    for (unsigned int i = 0; i < num_threads; i++) {
+        this->threads[i] = std::thread(&stat_pool::worker_loop, this);
+    }
+}
+
+stat_pool::~stat_pool() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+
+    this->job_ready.notify_all();
+
+    for (unsigned int i = 0; i < this->num_threads; i++) {
+        this->threads[i].join();
+    }
+
+    delete[] this->threads;
+}
+
+void stat_pool::stat_range(dir_reader &reader, dir_listing &listing, size_t start, size_t end) {
+    if (this->num_threads == 0 || end - start < STAT_POOL_MIN_JOB) {
+        for (size_t i = start; i < end; i++) {
+            reader.stat_entry(listing, i);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->job_reader = &reader;
+        this->job_listing = &listing;
+        this->next = start;
+        this->job_end = end;
+        this->busy = this->num_threads;
+        this->job_id++;
+    }
+
+    this->job_ready.notify_all();
+    this->work();
+
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while (this->busy != 0) {
+        this->job_done.wait(guard);
+    }
+}
+
+void stat_pool::worker_loop() {
+    unsigned long last_job = 0;
+
+    while (1) {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+
+            while (! this->stopping && this->job_id == last_job) {
+                this->job_ready.wait(guard);
+            }
+
+            if (this->stopping) {
+                return;
+            }
+
+            last_job = this->job_id;
+        }
+
+        this->work();
+
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if (--this->busy == 0) {
+            this->job_done.notify_one();
+        }
+    }
+}
+
+void stat_pool::work() {
+    while (1) {
+        size_t start = this->next.fetch_add(STAT_POOL_CHUNK);
+
+        if (start >= this->job_end) {
+            return;
+        }
+
+        size_t end = start + STAT_POOL_CHUNK < this->job_end ? start + STAT_POOL_CHUNK : this->job_end;
+
+        for (size_t i = start; i < end; i++) {
+            this->job_reader->stat_entry(*this->job_listing, i);
+        }
+    }
+}
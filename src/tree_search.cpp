@@ -0,0 +1,347 @@
+/*
+ * This file is part of fx, a graphical file explorer.
+ * Copyright (C) 2024  Joe Desmond
+ *
+ * fx is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * fx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with fx.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "../include/tree_search.h"
+#include "../include/util.h"
+
+tree_search::tree_search(unsigned int num_threads) {
+    this->num_walkers = num_threads;
+    this->generation = 0;
+    this->queued = 0;
+    this->stopping = false;
+    this->query[0] = '\0';
+    this->query_len = 0;
+    this->max_depth = 0;
+    this->root_len = 0;
+    this->root_dev = 0;
+    this->outstanding = 0;
+    this->num_searched = 0;
+    this->done = true;
+
+    this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    check_error(this->event_fd, -1);
+
+    this->walkers = new search_walker[num_threads];
+
+    for (unsigned int i = 0; i < num_threads; i++) {
+        this->walkers[i].thread = std::thread(&tree_search::walker_loop, this, i);
+    }
+}
+
+tree_search::~tree_search() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+        this->generation++;
+    }
+
+    this->wake.notify_all();
+
+    for (unsigned int i = 0; i < this->num_walkers; i++) {
+        this->walkers[i].thread.join();
+
+        for (size_t j = 0; j < this->walkers[i].dirs.size(); j++) {
+            free(this->walkers[i].dirs[j].path);
+        }
+    }
+
+    delete[] this->walkers;
+    close(this->event_fd);
+}
+
+void tree_search::start(const char * const root, const char * const query, size_t query_len, int max_depth) {
+    char * path = strdup(root);
+    check_error(path, (char *) nullptr);
+    unsigned long gen;
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if (query_len > NAME_MAX) {
+            query_len = NAME_MAX;
+        }
+
+        memcpy(this->query, query, query_len);
+        this->query[query_len] = '\0';
+        this->query_len = query_len;
+        this->max_depth = max_depth;
+        this->root_len = strlen(root);
+        this->outstanding = 1;
+        this->num_searched = 0;
+        this->done = false;
+        this->results.clear();
+        this->queued++;
+        gen = ++this->generation;
+    }
+
+    this->push(0, { path, 0, gen });
+    this->wake.notify_one();
+}
+
+void tree_search::cancel() {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    // Directories from the cancelled search are dropped as the walkers come to them
+    this->generation++;
+    this->outstanding = 0;
+    this->done = true;
+    this->results.clear();
+}
+
+bool tree_search::take(dir_listing &dest) {
+    uint64_t count;
+
+    // Reset the eventfd. This fails with EAGAIN if it wasn't set, which is fine
+    ssize_t retval = read(this->event_fd, &count, sizeof(count));
+    (void) retval;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    for (size_t i = 0; i < this->results.size(); i++) {
+        const path_segment &src = this->results.entry(i);
+        dest.add(this->results.name(src), src.len, src.mode);
+    }
+
+    this->results.clear();
+
+    return ! this->done;
+}
+
+size_t tree_search::dirs_searched() {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    return this->num_searched;
+}
+
+int tree_search::fd() const {
+    return this->event_fd;
+}
+
+void tree_search::walker_loop(unsigned int id) {
+    while (1) {
+        search_dir dir;
+
+        if (this->pop(id, &dir)) {
+            if (dir.gen == this->generation) {
+                this->search(id, dir);
+            }
+
+            free(dir.path);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(this->lock);
+
+        while (! this->stopping && this->queued <= 0) {
+            this->wake.wait(guard);
+        }
+
+        if (this->stopping) {
+            return;
+        }
+    }
+}
+
+bool tree_search::pop(unsigned int id, search_dir * dir) {
+    {
+        search_walker &own = this->walkers[id];
+        std::lock_guard<std::mutex> guard(own.lock);
+
+        if (! own.dirs.empty()) {
+            *dir = own.dirs.back();
+            own.dirs.pop_back();
+            this->queued--;
+
+            return true;
+        }
+    }
+
+    for (unsigned int i = 1; i < this->num_walkers; i++) {
+        search_walker &other = this->walkers[(id + i) % this->num_walkers];
+        std::lock_guard<std::mutex> guard(other.lock);
+
+        if (! other.dirs.empty()) {
+            *dir = other.dirs.front();
+            other.dirs.pop_front();
+            this->queued--;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void tree_search::push(unsigned int id, const search_dir &dir) {
+    search_walker &walker = this->walkers[id];
+    std::lock_guard<std::mutex> guard(walker.lock);
+
+    walker.dirs.push_back(dir);
+}
+
+void tree_search::search(unsigned int id, const search_dir &dir) {
+    search_walker &walker = this->walkers[id];
+    char query[NAME_MAX + 1];
+    size_t query_len;
+    int max_depth;
+    size_t root_len;
+    dev_t root_dev;
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if (dir.gen != this->generation) {
+            return;
+        }
+
+        memcpy(query, this->query, this->query_len + 1);
+        query_len = this->query_len;
+        max_depth = this->max_depth;
+        root_len = this->root_len;
+        root_dev = this->root_dev;
+    }
+
+    const size_t path_len = strlen(dir.path);
+    // Where the part of the path below the root starts. Paths under / don't have
+    // an extra slash.
+    const size_t rel_start = root_len == 1 ? 1 : root_len + 1;
+    const char * const rel = dir.depth == 0 ? "" : dir.path + rel_start;
+    const size_t rel_len = dir.depth == 0 ? 0 : path_len - rel_start;
+    std::vector<search_dir> subdirs;
+    char buf[PATH_MAX + 1];
+
+    walker.found.clear();
+
+    try {
+        // Symlinks aren't followed, so the walk can't loop
+        walker.reader.open(dir.path, O_NOFOLLOW);
+
+        dev_t dev = walker.reader.device();
+
+        if (dir.depth == 0) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->root_dev = root_dev = dev;
+        }
+
+        while (dev == root_dev && dir.gen == this->generation) {
+            walker.batch.clear();
+
+            size_t num_read = walker.reader.read_batch(walker.batch);
+
+            if (num_read == 0) {
+                break;
+            }
+
+            for (size_t i = 0; i < num_read; i++) {
+                path_segment &path = walker.batch.entry(i);
+                const char * const name = walker.batch.name(path);
+
+                if (is_dot_or_dotdot(name, path.len)) {
+                    continue;
+                }
+
+                if (path.mode == 0) {
+                    // DT_UNKNOWN; some filesystems don't fill in d_type
+                    walker.reader.stat_entry(walker.batch, i);
+                }
+
+                if (S_ISDIR(path.mode) && dir.depth < max_depth && path_len + 1 + path.len <= PATH_MAX) {
+                    char * subdir = (char *) malloc(path_len + path.len + 2);
+                    check_error(subdir, (char *) nullptr);
+
+                    if (path_len == 1) {
+                        sprintf(subdir, "/%s", name);
+                    } else {
+                        sprintf(subdir, "%s/%s", dir.path, name);
+                    }
+
+                    subdirs.push_back({ subdir, dir.depth + 1, dir.gen });
+                }
+            }
+
+            walker.filter.set_query(walker.batch, query, query_len);
+
+            for (size_t i = 0; i < walker.filter.size(); i++) {
+                const path_segment &path = walker.batch.at(walker.filter.row(i));
+                const char * const name = walker.batch.name(path);
+
+                // Bounded by the full path, since that's what opening the result joins
+                if (is_dot_or_dotdot(name, path.len) || path_len + 1 + path.len > PATH_MAX) {
+                    continue;
+                }
+
+                int len = rel_len == 0 ? snprintf(buf, sizeof(buf), "%s", name) : snprintf(buf, sizeof(buf), "%s/%s", rel, name);
+                walker.found.add(buf, len, path.mode);
+            }
+        }
+
+        walker.reader.close();
+    } catch (int e) {
+        // Unreadable directories are left out, like `find` does
+        walker.reader.close();
+    }
+
+    for (size_t i = 0; i < subdirs.size(); i++) {
+        this->push(id, subdirs[i]);
+    }
+
+    bool finished = false;
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        this->queued += subdirs.size();
+
+        if (dir.gen == this->generation) {
+            for (size_t i = 0; i < walker.found.size(); i++) {
+                const path_segment &src = walker.found.entry(i);
+                this->results.add(walker.found.name(src), src.len, src.mode);
+            }
+
+            this->outstanding += subdirs.size();
+            this->outstanding--;
+            this->num_searched++;
+
+            if (this->outstanding == 0) {
+                this->done = finished = true;
+            }
+        }
+    }
+
+    if (subdirs.size() > 1) {
+        this->wake.notify_all();
+    } else if (subdirs.size() == 1) {
+        this->wake.notify_one();
+    }
+
+    if (walker.found.size() != 0 || finished) {
+        this->notify();
+    }
+}
+
+void tree_search::notify() {
+    uint64_t one = 1;
+    ssize_t retval = write(this->event_fd, &one, sizeof(one));
+    check_error(retval, (ssize_t) -1);
+}
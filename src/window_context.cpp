@@ -15,29 +15,18 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with fx.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <X11/keysym.h>
 #include <X11/Xutil.h>
+#include "../include/perf_stats.h"
+#include "../include/util.h"
 #include "../include/window_context.h"
 
-template <typename T>
-static void check_error(T val, T error_state) {
-    if (val == error_state) {
-        perror(nullptr);
-
-        throw errno;
-    }
-}
-
-template <typename T, size_t N>
-static constexpr size_t c_arr_size(const T(&)[N]) {
-    return N;
-}
-
 template <size_t N>
 void window_context::print_multiline_str(const char (&str)[N], int x, int y) {
     size_t start = 0;
@@ -46,7 +35,7 @@ void window_context::print_multiline_str(const char (&str)[N], int x, int y) {
 
     while (str[end] && end < N) {
         if (str[end] == '\n') {
-            XDrawString(this->dis, this->back_buffer, this->gc, x, curr_y, str + start, end - start);
+            this->back_buffer->draw_string(x, curr_y, str + start, end - start);
             curr_y += ROW_HEIGHT;
             start = end + 1;
         }
@@ -54,79 +43,81 @@ void window_context::print_multiline_str(const char (&str)[N], int x, int y) {
         end++;
     }
 
-    XDrawString(this->dis, this->back_buffer, this->gc, x, curr_y, str + start, end - start);
+    this->back_buffer->draw_string(x, curr_y, str + start, end - start);
 }
 
-static unsigned long get_color(Display * dis, int screen, XColor * color_info, const char * const color_name) {
-    XParseColor(dis, DefaultColormap(dis, screen), color_name, color_info);
-    XAllocColor(dis, DefaultColormap(dis, screen), color_info);
+// Memory budget for the directory cache, in bytes. Set FX_CACHE_MB to change it
+static size_t get_cache_budget() {
+    const char * const val = getenv("FX_CACHE_MB");
 
-    return color_info->pixel;
-}
-
-static int str_cmp(const char * const a, size_t a_len, const char * const b, size_t b_len) {
-    size_t len = a_len <= b_len ? a_len : b_len;
+    if (! val) {
+        return DIR_CACHE_DEFAULT_BUDGET;
+    }
 
-    for (int i = 0; i < len; i++) {
-        char a_char = a[i];
-        char b_char = b[i];
+    return strtoull(val, nullptr, 10) * 1024 * 1024;
+}
 
-        if (a_char < b_char) {
-            return -1;
-        } else if (a_char > b_char) {
-            return 1;
-        }
-    }
+// How deep a search goes. Set FX_SEARCH_DEPTH to change it
+static int get_search_depth() {
+    const char * const val = getenv("FX_SEARCH_DEPTH");
 
-    if (a_len < b_len) {
-        return -1;
-    } else if (a_len > b_len) {
-        return 1;
+    if (! val) {
+        return SEARCH_DEFAULT_MAX_DEPTH;
     }
 
-    // This should never be possible for filenames in the same directory
-    return 0;
+    return atoi(val);
 }
 
-static int partition(path_segment * a, int lo, int hi) {
-    path_segment * pivot = a + lo;
+// The directory fx starts in
+static const char * get_start_dir() {
+    static char path[PATH_MAX + 1];
 
-    int i = lo - 1;
-    int j = hi + 1;
-
-    while (1) {
-        do {
-            i++;
-        } while (str_cmp((a + i)->name, (a + i)->len, pivot->name, pivot->len) < 0);
+    char * retval = getcwd(path, PATH_MAX + 1);
+    check_error(retval, (char *) NULL);
 
-        do {
-            j--;
-        } while (str_cmp((a + j)->name, (a + j)->len, pivot->name, pivot->len) > 0);
+    return path;
+}
 
-        if (i >= j) {
-            return j;
-        }
+// Scales an 8 bit channel to fill `mask`
+static unsigned long scale_channel(unsigned int value, unsigned long mask) {
+    const int shift = __builtin_ctzl(mask);
+    const unsigned long max = mask >> shift;
 
-        path_segment tmp = a[i];
-        a[i] = a[j];
-        a[j] = tmp;
-    }
+    return ((value * max + 127) / 255) << shift;
 }
 
-// Quicksort with Hoare's partitioning scheme
-static void quicksort(path_segment * a, int lo, int hi) {
-    if (lo >= 0 && hi >= 0 && lo < hi) {
-        int p = partition(a, lo, hi);
+// On a TrueColor visual the pixel value is just the color, so there's nothing to
+// ask the server. Anything else needs a colormap entry, which costs a round trip.
+static unsigned long get_color(Display * dis, int screen, unsigned int red, unsigned int green, unsigned int blue, unsigned int &round_trips) {
+    const Visual * const visual = DefaultVisual(dis, screen);
 
-        quicksort(a, lo, p);
-        quicksort(a, p + 1, hi);
+    if (visual->c_class == TrueColor) {
+        return scale_channel(red, visual->red_mask) | scale_channel(green, visual->green_mask) | scale_channel(blue, visual->blue_mask);
     }
+
+    XColor color_info;
+    color_info.red = red * 257;
+    color_info.green = green * 257;
+    color_info.blue = blue * 257;
+    color_info.flags = DoRed | DoGreen | DoBlue;
+    XAllocColor(dis, DefaultColormap(dis, screen), &color_info);
+    round_trips++;
+
+    return color_info.pixel;
 }
 
-window_context::window_context(int x, int y, unsigned int width, unsigned int height, const char * const title) {
+window_context::window_context(int x, int y, unsigned int width, unsigned int height, const char * const title) :
+    model(get_start_dir(), get_cache_budget()), view(LIST_TOP, ROW_HEIGHT) {
     unsigned long white;
 
+    this->startup.start_ns = perf_now_ns();
+    this->startup.first_frame_ns = 0;
+    this->startup.deferred_ns = 0;
+    this->startup.deferred_round_trips = 0;
     this->dis = XOpenDisplay((char *) 0);
+    // Connection setup; Xlib may query an extension or two in here as well
+    this->startup.connect_ns = perf_now_ns() - this->startup.start_ns;
+    this->startup.round_trips = 1;
     this->screen = DefaultScreen(this->dis);
     this->black = BlackPixel(this->dis, this->screen);
     white = WhitePixel(this->dis, this->screen);
@@ -134,245 +125,837 @@ window_context::window_context(int x, int y, unsigned int width, unsigned int he
     this->win = XCreateSimpleWindow(this->dis, DefaultRootWindow(this->dis), x, y, width, height, 5, white, this->black);
 
     XSetStandardProperties(this->dis, this->win, title, "TODO", None, nullptr, 0, nullptr);
-    XSelectInput(this->dis, this->win, ExposureMask | ButtonPressMask | KeyPressMask | PointerMotionMask);
+    // The size is tracked from ConfigureNotify so that nothing has to ask for it
+    XSelectInput(this->dis, this->win, ExposureMask | ButtonPressMask | KeyPressMask | PointerMotionMask | StructureNotifyMask);
+    this->win_width = width;
+    this->win_height = height;
+    // Interned after the first frame
+    this->wm_delete = None;
 
     this->gc = XCreateGC(this->dis, this->win, 0, 0);
 
     XClearWindow(this->dis, this->win);
-    XMapRaised(this->dis, this->win);
-
-    XColor tmp;
-    this->text_color = get_color(this->dis, this->screen, &tmp, "slate blue");
-    this->file_color = get_color(this->dis, this->screen, &tmp, "slate gray");
-    this->dir_color = get_color(this->dis, this->screen, &tmp, "yellow");
-    this->debug_color = get_color(this->dis, this->screen, &tmp, "red");
-    this->hover_color = get_color(this->dis, this->screen, &tmp, "gray78");
-    this->no_perm_color = get_color(this->dis, this->screen, &tmp, "red");
-    this->status_color = get_color(this->dis, this->screen, &tmp, "green");
-
-    char * retval = getcwd(this->cwd, PATH_MAX + 1);
-    check_error(retval, (char *) NULL);
-
-    this->cwd_len = strlen(this->cwd);
 
-    this->dir = opendir(this->cwd);
-    check_error(this->dir, (DIR *) NULL);
+    this->text_color = get_color(this->dis, this->screen, 106, 90, 205, this->startup.round_trips); // slate blue
+    this->file_color = get_color(this->dis, this->screen, 112, 128, 144, this->startup.round_trips); // slate gray
+    this->dir_color = get_color(this->dis, this->screen, 255, 255, 0, this->startup.round_trips); // yellow
+    this->debug_color = get_color(this->dis, this->screen, 255, 0, 0, this->startup.round_trips); // red
+    this->hover_color = get_color(this->dis, this->screen, 199, 199, 199, this->startup.round_trips); // gray78
+    this->no_perm_color = get_color(this->dis, this->screen, 255, 0, 0, this->startup.round_trips); // red
+    this->status_color = get_color(this->dis, this->screen, 0, 255, 0, this->startup.round_trips); // green
 
-    for (int i = 0; i < MAX_CHILDREN; i++) {
-        this->children[i].len = 0;
-    }
-
-    this->read_child_dirs(0);
+    this->showing_progress = false;
 
     this->debug_enabled = false;
     this->mouse_y = 0;
-    // An arbitrary, large number
-    this->max_y = 4096;
-    this->can_scroll = false;
-    this->scrollrow = 0;
-    this->tmp_path[0] = '\0';
-    this->tmp_path_len = 0;
+    this->pending_top = 0;
+    this->dwell_entry = SIZE_MAX;
+    this->dwell_since_ns = 0;
+    this->dwell_pending = false;
     this->status[0] = '\0';
     this->status_len = 0;
+    this->num_damage = 0;
+    this->hover_row = -1;
+    this->pending_scroll = 0;
+    this->needs_redraw = true;
+    this->last_frame_ns = 0;
+    this->last_frame_requests = 0;
+    this->total_frame_requests = 0;
+    this->perf_log = getenv("FX_PERF_LOG");
+    this->model.get_perf().enabled = this->perf_log != nullptr;
+    this->show_help = false;
+    this->prompt = PROMPT_NONE;
+    this->filter_len = 0;
+    this->search_len = 0;
+    this->cd_target[0] = '\0';
+    this->shown = false;
+
+    const char * const render = getenv("FX_RENDER");
+    this->back_buffer = nullptr;
+
+    if (render && strcmp(render, "client") == 0) {
+        this->back_buffer = image_canvas::create(this->dis, this->win, this->gc, this->win_width, this->win_height, this->startup.round_trips);
+    }
 
-    this->uid = getuid();
-    this->gid = getgid();
+    // Also if the visual is one the client side canvas can't draw into
+    if (! this->back_buffer) {
+        this->back_buffer = new server_canvas(this->dis, this->win, this->gc, this->win_width, this->win_height);
+    }
 
-    XGetWindowAttributes(this->dis, this->win, &this->window_attrs);
-    this->back_buffer = XCreatePixmap(this->dis, this->win, this->window_attrs.width, this->window_attrs.height, 24);
-    this->max_area = this->window_attrs.width * this->window_attrs.height;
+    this->max_area = this->win_width * this->win_height;
 
     this->set_status("Press 'h' for help");
 }
 
 window_context::~window_context() {
-    int retval = closedir(this->dir);
-    check_error(retval, -1);
+    this->model.save_snapshot();
+
+    if (this->perf_log) {
+        FILE * out = strcmp(this->perf_log, "-") == 0 ? stderr : fopen(this->perf_log, "w");
 
-    XFreePixmap(this->dis, this->back_buffer);
+        if (out) {
+            this->dump_perf(out);
+
+            if (out != stderr) {
+                fclose(out);
+            }
+        } else {
+            perror(this->perf_log);
+        }
+    }
+
+    delete this->back_buffer;
     XFreeGC(this->dis, this->gc);
     XDestroyWindow(this->dis, this->win);
     XCloseDisplay(this->dis);
 }
 
 int window_context::on_expose(XExposeEvent &event) {
-    int old_w = this->window_attrs.width;
-    int old_h = this->window_attrs.height;
+    this->needs_redraw = true;
 
-    XGetWindowAttributes(this->dis, this->win, &this->window_attrs);
+    return NO_EXIT;
+}
 
-    int new_w = this->window_attrs.width;
-    int new_h = this->window_attrs.height;
+int window_context::on_configure(XConfigureEvent &event) {
+    int old_w = this->win_width;
+    int old_h = this->win_height;
+    int new_w = event.width;
+    int new_h = event.height;
+
+    // Moving the window doesn't change anything
+    if (new_w == old_w && new_h == old_h) {
+        return NO_EXIT;
+    }
+
+    this->win_width = new_w;
+    this->win_height = new_h;
 
     if (new_w > old_w || new_h > old_h) {
-        // Reallocate the pixmap
-        XFreePixmap(this->dis, this->back_buffer);
-        this->back_buffer = XCreatePixmap(this->dis, this->win, new_w, new_h, 24);
+        // Reallocate the back buffer
+        this->back_buffer->resize(new_w, new_h);
         this->max_area = new_w * new_h;
     } else {
-        // Shrink the pixmap only if the new size is a quarter of the max. This is only to save some
+        // Shrink the back buffer only if the new size is a quarter of the max. This is only to save some
         // memory - we don't actually care about whatever doesn't fit in the window
         int new_area = new_w * new_h;
 
         if (new_area * 4 <= this->max_area) {
             this->max_area = new_area;
-            XFreePixmap(this->dis, this->back_buffer);
-            this->back_buffer = XCreatePixmap(this->dis, this->win, new_w, new_h, 24);
+            this->back_buffer->resize(new_w, new_h);
         }
     }
 
-    this->redraw();
+    this->needs_redraw = true;
+
+    return NO_EXIT;
+}
+
+int window_context::on_other_event(XEvent &event) {
+    this->back_buffer->on_event(event);
+
+    return NO_EXIT;
+}
+
+int window_context::on_mapping(XMappingEvent &event) {
+    XRefreshKeyboardMapping(&event);
+
+    return NO_EXIT;
+}
+
+int window_context::on_client_message(XClientMessageEvent &event) {
+    if (event.format == 32 && (Atom) event.data.l[0] == this->wm_delete) {
+        return USER_QUIT_EXIT_CODE;
+    }
 
     return NO_EXIT;
 }
 
+void window_context::show() {
+    XMapRaised(this->dis, this->win);
+    this->shown = true;
+}
+
+void window_context::hide() {
+    XUnmapWindow(this->dis, this->win);
+    XFlush(this->dis);
+    this->shown = false;
+    this->model.save_snapshot();
+}
+
+void window_context::open(const char * const path) {
+    this->prompt = PROMPT_NONE;
+    this->show_help = false;
+    this->hover_row = -1;
+    this->pending_scroll = 0;
+    this->cd_target[0] = '\0';
+    this->startup.start_ns = perf_now_ns();
+    this->startup.connect_ns = 0;
+    this->startup.first_frame_ns = 0;
+    this->startup.round_trips = 0;
+    this->set_status("Press 'h' for help");
+    this->history.clear();
+    this->model.open(path);
+    this->navigated(0);
+    this->show();
+}
+
+const char * window_context::get_cd_target() const {
+    return this->cd_target;
+}
+
 int window_context::on_button_press(XButtonEvent &event) {
     if (this->show_help) {
         this->show_help = false;
-        this->redraw();
+        this->needs_redraw = true;
     } else if (event.button == Button1) {
-        for (int i = 0; i < MAX_CHILDREN; i++) {
-            path_segment &path = this->children[i];
-
-            if (path.len == 0) {
-                break;
-            }
-
-            if (event.y >= (path.y_bot - 10) && event.y <= path.y_bot) {
-                if (! this->has_permission(path)) {
-                    this->set_status("No permission");
-                } else {
-                    if (S_ISDIR(path.mode)) {
-                        this->navigate(path);
-                    }
-                    this->set_status("");
+        size_t entry;
+
+        if (this->view.entry_at(event.y, &entry) && entry < this->model.num_shown()) {
+            dir_listing &listing = this->model.shown_listing();
+            const size_t row = this->model.shown_row(entry);
+            const uint8_t flags = listing.flags_at(row);
+
+            const path_segment &path = listing.at(row);
+
+            if (! (flags & ENTRY_PERMITTED)) {
+                this->set_status("No permission");
+            } else if ((flags & ENTRY_DIR) && ! dir_model::join_fits(this->model.cwd_len(), listing.name(path), path.len)) {
+                this->set_status("Path too long");
+            } else {
+                if (flags & ENTRY_DIR) {
+                    this->navigate(listing.name(path), path.len);
                 }
-
-                this->redraw();
-                break;
+                this->set_status("");
+                this->needs_redraw = true;
             }
         }
-    } else if (this->can_scroll && event.button == Button4) {
-        if (this->scrollrow > 0) {
-            this->scrollrow--;
-        }
-
-        this->redraw();
-    } else if (this->can_scroll && event.button == Button5) {
-        if (this->scrollrow < this->max_scrollrow) {
-            this->scrollrow++;
-        }
-
-        this->redraw();
+    } else if (this->view.can_scroll() && (event.button == Button4 || event.button == Button5)) {
+        // Clicks that arrive before the next frame add up to one scroll
+        this->pending_scroll += event.button == Button4 ? -1 : 1;
+    } else if (event.button == BACK_BUTTON || event.button == FORWARD_BUTTON) {
+        this->go_back(event.button == FORWARD_BUTTON);
     }
 
     return NO_EXIT;
 }
 
 int window_context::on_key_press(XKeyEvent &event) {
-    int num_keysyms;
-
-    KeySym * keysyms = XGetKeyboardMapping(this->dis, event.keycode, 1, &num_keysyms);
-    KeySym key = keysyms[0];
+    // Xlib keeps its own copy of the keymap, so this doesn't ask the server
+    KeySym key = XLookupKeysym(&event, 0);
 
     if (this->show_help) {
         this->show_help = false;
-        this->redraw();
+        this->needs_redraw = true;
+    }
+
+    if (this->prompt != PROMPT_NONE) {
+        this->on_prompt_key(event);
+
+        return NO_EXIT;
     }
 
     if (key == 'd') {
         this->set_debug_mode(! this->debug_enabled);
     } else if (key == 'q') {
-        XFree(keysyms);
-
         return USER_QUIT_EXIT_CODE;
     } else if (key == 'c') {
-        path_segment * path = this->get_selected_segment();
+        dir_listing &listing = this->model.shown_listing();
+        size_t row;
 
-        if (! S_ISDIR(path->mode)) {
+        if (! this->get_selected_row(&row)) {
+            this->set_status("Nothing selected");
+        } else if (! (listing.flags_at(row) & ENTRY_DIR)) {
             this->set_status("Can only navigate to a directory");
-        } else if (! this->has_permission(*path)) {
+        } else if (! (listing.flags_at(row) & ENTRY_PERMITTED)) {
             this->set_status("No permission");
+        } else if (! dir_model::join_fits(this->model.cwd_len(), listing.name(listing.at(row)), listing.at(row).len)) {
+            this->set_status("Path too long");
         } else {
-            this->path_join(this->cwd, &this->cwd_len, *path);
-            printf("cd %s\n", this->cwd);
-            XFree(keysyms);
+            const path_segment &path = listing.at(row);
+            char dest[PATH_MAX + 1];
+            size_t dest_len = this->model.cwd_len();
+
+            memcpy(dest, this->model.cwd(), dest_len + 1);
+            dir_model::path_join(dest, &dest_len, listing.name(path), path.len);
+            memcpy(this->cd_target, dest, dest_len + 1);
 
             return USER_CD_EXIT_CODE;
         }
-
-        this->redraw();
     } else if (key == 'h') {
         this->show_help = true;
-        this->redraw();
+        this->needs_redraw = true;
+    } else if (key == '/' && ! this->model.is_searching()) {
+        this->prompt = PROMPT_FILTER;
+        this->show_filter_status();
+    } else if (key == 'f') {
+        this->prompt = PROMPT_SEARCH;
+        this->search_len = 0;
+        this->show_search_status();
+    } else if (key == XK_Left || key == XK_BackSpace) {
+        this->go_back(false);
+    } else if (key == XK_Right) {
+        this->go_back(true);
+    } else if (key == XK_Escape) {
+        if (this->model.is_searching()) {
+            this->stop_search();
+            this->set_status("");
+        } else if (this->model.is_filtered()) {
+            this->clear_filter();
+            this->set_status("");
+            this->needs_redraw = true;
+        }
     }
 
-    XFree(keysyms);
+    return NO_EXIT;
+}
+
+void window_context::on_prompt_key(XKeyEvent &event) {
+    const bool is_filter = this->prompt == PROMPT_FILTER;
+    char * const text = is_filter ? this->filter_text : this->search_text;
+    size_t * const len = is_filter ? &this->filter_len : &this->search_len;
+    char typed[8];
+    KeySym key;
+    int typed_len = XLookupString(&event, typed, sizeof(typed), &key, nullptr);
+
+    if (key == XK_Escape) {
+        if (is_filter) {
+            this->clear_filter();
+            this->needs_redraw = true;
+        }
+
+        this->prompt = PROMPT_NONE;
+        this->set_status("");
+
+        return;
+    } else if (key == XK_Return || key == XK_KP_Enter) {
+        this->prompt = PROMPT_NONE;
+
+        if (is_filter) {
+            // Keep the filter, but let keys be commands again
+            this->show_filter_status();
+        } else if (*len != 0) {
+            this->start_search();
+        } else {
+            this->set_status("");
+        }
+
+        return;
+    } else if (key == XK_BackSpace) {
+        if (*len == 0) {
+            return;
+        }
+
+        (*len)--;
+    } else if (typed_len == 1 && (unsigned char) typed[0] >= ' ' && typed[0] != 0x7f && typed[0] != '/' && *len < NAME_MAX) {
+        text[(*len)++] = typed[0];
+    } else {
+        return;
+    }
+
+    if (! is_filter) {
+        this->show_search_status();
+        return;
+    }
+
+    this->model.set_filter(this->filter_text, this->filter_len);
+    this->update_layout();
+    this->view.scroll_to(0);
+    this->show_filter_status();
+    this->needs_redraw = true;
+}
+
+void window_context::clear_filter() {
+    if (this->prompt == PROMPT_FILTER) {
+        this->prompt = PROMPT_NONE;
+    }
+
+    this->filter_len = 0;
+    this->model.clear_filter();
+    this->update_layout();
+}
+
+void window_context::show_filter_status() {
+    char msg[c_arr_size(this->status)];
+
+    if (this->filter_len == 0) {
+        snprintf(msg, sizeof(msg), "/");
+    } else {
+        snprintf(msg, sizeof(msg), "/%.*s (%zu matches)", (int) this->filter_len, this->filter_text, this->model.num_shown());
+    }
+
+    this->set_status(msg);
+}
+
+void window_context::start_search() {
+    this->clear_filter();
+    this->model.start_search(this->search_text, this->search_len, get_search_depth());
+    this->update_layout();
+    this->view.scroll_to(0);
+    this->show_search_status();
+    this->needs_redraw = true;
+}
+
+void window_context::stop_search() {
+    this->model.stop_search();
+    this->update_layout();
+    this->view.scroll_to(0);
+    this->needs_redraw = true;
+}
+
+void window_context::show_search_status() {
+    char msg[c_arr_size(this->status)];
+    const int len = this->search_len;
+
+    if (this->prompt == PROMPT_SEARCH) {
+        snprintf(msg, sizeof(msg), "Find: %.*s", len, this->search_text);
+    } else if (this->model.is_search_running()) {
+        snprintf(
+            msg, sizeof(msg), "Searching for \"%.*s\": %zu matches in %zu dirs",
+            len, this->search_text, this->model.num_shown(), this->model.search_dirs_searched()
+        );
+    } else {
+        snprintf(msg, sizeof(msg), "%zu matches for \"%.*s\" (Escape to go back)", this->model.num_shown(), len, this->search_text);
+    }
+
+    this->set_status(msg);
+}
+
+int window_context::on_search_progress() {
+    if (! this->model.on_search_progress()) {
+        return NO_EXIT;
+    }
+
+    this->update_layout();
+    this->show_search_status();
+    this->needs_redraw = true;
 
     return NO_EXIT;
 }
 
-int window_context::on_motion(XMotionEvent &event) {
-    int curr_row = (this->mouse_y - 10) / ROW_HEIGHT;
-    int next_row = (event.y - 10) / ROW_HEIGHT;
+int window_context::search_fd() const {
+    return this->model.search_fd();
+}
+
+int window_context::on_size_progress() {
+    const uint32_t update = this->model.on_size_progress();
+
+    if (update == 0 || this->model.is_searching() || this->needs_redraw) {
+        return NO_EXIT;
+    }
+
+    // Only the rows whose sizes changed are drawn again
+    const dir_listing &listing = this->model.listing();
+    const int visible = this->view.visible_rows();
+
+    for (int k = 0; k < visible; k++) {
+        const dir_size * size = this->model.size_of(listing.index_at(this->model.shown_row(this->view.first() + k)));
+
+        if (size && size->update == update) {
+            this->damage_row(k);
+        }
+    }
+
+    return NO_EXIT;
+}
+
+int window_context::size_fd() const {
+    return this->model.size_fd();
+}
+
+int window_context::on_prefetch_progress() {
+    // Move on to the neighbours of the entry under the mouse, if it's still there
+    if (this->model.on_prefetch_progress() && ! this->dwell_pending && this->dwell_entry != SIZE_MAX) {
+        this->model.prefetch_around(this->dwell_entry);
+    }
+
+    return NO_EXIT;
+}
+
+int window_context::prefetch_fd() const {
+    return this->model.prefetch_fd();
+}
 
+int window_context::on_motion(XMotionEvent &event) {
+    // Only the latest position matters. The highlight is moved when the next frame
+    // is drawn, so a burst of motion events costs one repaint.
     this->mouse_y = event.y;
+    this->track_dwell(false);
 
-    if (this->mouse_y <= this->max_y && curr_row != next_row) {
-        this->redraw();
+    return NO_EXIT;
+}
+
+void window_context::track_dwell(bool restart) {
+    size_t entry;
+
+    if (! this->view.entry_at(this->mouse_y, &entry)) {
+        this->dwell_entry = SIZE_MAX;
+        this->dwell_pending = false;
+    } else if (restart || entry != this->dwell_entry) {
+        this->dwell_entry = entry;
+        this->dwell_since_ns = perf_now_ns();
+        this->dwell_pending = true;
+    }
+}
+
+int window_context::on_load_progress() {
+    const bool was_done = this->model.is_load_done();
+    int retval = this->model.on_load_progress();
+    char msg[c_arr_size(this->status)];
+
+    // Clicks handled before the next frame have to see the merged rows
+    this->update_layout();
+
+    if (retval == LOAD_IN_PROGRESS) {
+        snprintf(msg, sizeof(msg), "Loading... %zu entries", this->model.listing().size());
+        this->set_status(msg);
+        this->showing_progress = true;
+    } else if (retval != LOAD_DONE) {
+        snprintf(msg, sizeof(msg), "Can't read directory: %s", strerror(retval));
+        this->set_status(msg);
+        this->showing_progress = false;
+
+        // The model went back up a level, which is usually where we came from
+        const size_t top = this->history.position_of(this->model.cwd());
+
+        this->history.drop_last(this->model.cwd());
+        this->navigated(top);
+    } else {
+        if (this->showing_progress) {
+            this->set_status("");
+            this->showing_progress = false;
+        }
+
+        if (! was_done) {
+            // Unless it's been scrolled in the meantime
+            if (this->pending_top != 0 && this->view.first() == 0) {
+                this->view.scroll_to(this->pending_top);
+            }
+
+            this->pending_top = 0;
+
+            // Nothing is prefetched until the listing is done, so start over once it is
+            this->track_dwell(true);
+        }
+    }
+
+    this->needs_redraw = true;
+
+    return NO_EXIT;
+}
+
+int window_context::load_fd() const {
+    return this->model.load_fd();
+}
+
+int window_context::on_cache_event() {
+    const size_t top = this->top_row();
+
+    if (this->model.on_cache_event()) {
+        // Same directory, loaded again
+        this->navigated(top);
+        this->needs_redraw = true;
+    }
+
+    return NO_EXIT;
+}
+
+int window_context::on_timer() {
+    if (this->live_update_timeout() == 0) {
+        this->apply_live_changes();
+        this->needs_redraw = true;
+    }
+
+    if (this->prefetch_timeout() == 0) {
+        this->dwell_pending = false;
+        this->model.prefetch_around(this->dwell_entry);
+    }
+
+    if (this->frame_timeout() == 0) {
+        this->render();
     }
 
     return NO_EXIT;
 }
 
+// The sooner of two timeouts, either of which can be -1 for none
+static int min_timeout(int a, int b) {
+    if (a == -1) {
+        return b;
+    }
+
+    if (b == -1) {
+        return a;
+    }
+
+    return a < b ? a : b;
+}
+
+int window_context::next_timeout() const {
+    return min_timeout(min_timeout(this->live_update_timeout(), this->frame_timeout()), this->prefetch_timeout());
+}
+
+// Milliseconds until `deadline_ns`, rounded up so that we don't wake up just before it
+static int ms_until(long long deadline_ns) {
+    long long wait_ns = deadline_ns - (long long) perf_now_ns();
+
+    if (wait_ns <= 0) {
+        return 0;
+    }
+
+    return (wait_ns + 999999) / 1000000;
+}
+
+int window_context::live_update_timeout() const {
+    if (! this->model.has_live_changes()) {
+        return -1;
+    }
+
+    return ms_until((long long) this->model.live_changes_since() + LIVE_UPDATE_DELAY_MS * 1000000ll);
+}
+
+int window_context::frame_timeout() const {
+    if (! this->has_frame_work()) {
+        return -1;
+    }
+
+    return ms_until(this->last_frame_ns + FRAME_INTERVAL_MS * 1000000ll);
+}
+
+int window_context::prefetch_timeout() const {
+    if (! this->dwell_pending) {
+        return -1;
+    }
+
+    return ms_until(this->dwell_since_ns + PREFETCH_DWELL_MS * 1000000ll);
+}
+
+bool window_context::has_frame_work() const {
+    return this->needs_redraw || this->pending_scroll != 0 || this->num_damage != 0 || this->view.screen_row_at(this->mouse_y) != this->hover_row;
+}
+
+void window_context::render() {
+    const unsigned long long start = this->model.get_perf().start();
+    const unsigned long first_request = NextRequest(this->dis);
+
+    this->back_buffer->begin();
+    this->draw_frame();
+
+    if (this->shown && this->startup.first_frame_ns == 0) {
+        this->startup.first_frame_ns = perf_now_ns() - this->startup.start_ns;
+        this->finish_setup();
+    }
+
+    if (start) {
+        // Requests are counted as they're queued, so this doesn't wait on the server
+        this->last_frame_requests = NextRequest(this->dis) - first_request;
+        this->total_frame_requests += this->last_frame_requests;
+        perf_stats::stop(this->frame_times, start);
+    }
+
+    if (this->debug_enabled && ! this->show_help) {
+        this->draw_perf_overlay();
+    }
+
+    this->back_buffer->flush();
+}
+
+void window_context::draw_frame() {
+    this->last_frame_ns = perf_now_ns();
+
+    if (this->show_help) {
+        if (this->needs_redraw) {
+            this->draw_help();
+        }
+
+        // Nothing else is visible
+        this->needs_redraw = false;
+        this->pending_scroll = 0;
+        this->num_damage = 0;
+        this->hover_row = this->view.screen_row_at(this->mouse_y);
+
+        return;
+    }
+
+    if (this->pending_scroll != 0) {
+        this->scroll_by(this->pending_scroll);
+        this->pending_scroll = 0;
+    }
+
+    if (this->needs_redraw) {
+        this->redraw();
+
+        return;
+    }
+
+    int next_hover = this->view.screen_row_at(this->mouse_y);
+
+    // Only the rows that gain or lose the highlight change
+    if (next_hover != this->hover_row) {
+        this->damage_row(this->hover_row);
+        this->damage_row(next_hover);
+        this->hover_row = next_hover;
+    }
+
+    this->repaint();
+}
+
+void window_context::apply_live_changes() {
+    const size_t top = this->model.apply_live_changes(this->view.first());
+
+    // Rows may have gone away, so the view has to know before anything looks at it
+    this->update_layout();
+    this->view.scroll_to(top);
+}
+
+int window_context::cache_fd() const {
+    return this->model.cache_fd();
+}
+
 void window_context::set_debug_mode(bool enabled) {
     this->debug_enabled = enabled;
+    this->model.get_perf().enabled = enabled || this->perf_log;
 
     if (this->debug_enabled) {
-        this->set_status("Debug mode enabled");
+        this->show_cache_stats();
     } else {
         this->set_status("Debug mode disabled");
     }
 
-    this->redraw();
+    this->needs_redraw = true;
 }
 
-void window_context::read_child_dirs(int start_at) {
-    int i = start_at;
-    struct dirent * entry;
-    int retval;
-
-    while (i < MAX_CHILDREN && (entry = readdir(this->dir)) != NULL) {
-        memcpy(this->children[i].name, entry->d_name, 256);
+void window_context::draw_perf_overlay() {
+    const perf_stats &perf = this->model.get_perf();
+    const dir_listing &listing = this->model.listing();
+    const uint64_t frames = this->frame_times.count();
+    const int x = this->win_width > PERF_OVERLAY_WIDTH ? this->win_width - PERF_OVERLAY_WIDTH : 0;
+    const int top = LIST_TOP + TEXT_DESCENT;
+    const int height = PERF_OVERLAY_LINES * ROW_HEIGHT + TEXT_DESCENT;
+    char lines[PERF_OVERLAY_LINES][128];
+    char load[16];
+
+    this->frame_times.summarize(lines[0], sizeof(lines[0]), "frame");
+    snprintf(
+        lines[1], sizeof(lines[1]), "%-8s %6lu last, %.1f per frame (%s)", "X reqs",
+        this->last_frame_requests, frames == 0 ? 0.0 : (double) this->total_frame_requests / frames, this->back_buffer->name()
+    );
+    perf.readdir.summarize(lines[2], sizeof(lines[2]), "readdir");
+    perf.stat.summarize(lines[3], sizeof(lines[3]), "stat");
+    perf.sort.summarize(lines[4], sizeof(lines[4]), "sort");
+
+    if (perf.load_ns != 0) {
+        format_ns(load, sizeof(load), perf.load_ns);
+    } else {
+        snprintf(load, sizeof(load), "loading");
+    }
 
-        this->children[i].len = strlen(this->children[i].name);
+    snprintf(lines[5], sizeof(lines[5]), "%-8s %s", "load", load);
+    snprintf(lines[6], sizeof(lines[6]), "%-8s %zu entries, %zu KiB", "listing", listing.size(), listing.memory_usage() / 1024);
+    this->format_startup(lines[7], sizeof(lines[7]));
 
-        memcpy(this->tmp_path, this->cwd, this->cwd_len + 1);
-        this->tmp_path_len = this->cwd_len;
-        this->path_join(this->tmp_path, &this->tmp_path_len, this->children[i]);
+    this->back_buffer->set_color(this->black);
+    this->back_buffer->fill_rect(x, top, PERF_OVERLAY_WIDTH, height);
+    this->back_buffer->set_color(this->debug_color);
+    this->back_buffer->draw_rect(x, top, PERF_OVERLAY_WIDTH - 1, height - 1);
+    this->back_buffer->set_color(this->status_color);
 
-        retval = stat(this->tmp_path, &this->tmp_stat);
-        check_error(retval, -1);
+    for (int i = 0; i < PERF_OVERLAY_LINES; i++) {
+        this->back_buffer->draw_string(x + 4, top + (i + 1) * ROW_HEIGHT, lines[i], strlen(lines[i]));
+    }
 
-        this->children[i].mode = this->tmp_stat.st_mode;
-        this->children[i].uid = this->tmp_stat.st_uid;
-        this->children[i].gid = this->tmp_stat.st_gid;
+    this->back_buffer->set_color(this->text_color);
+    this->back_buffer->present(x, top, PERF_OVERLAY_WIDTH, height);
+}
 
-        i++;
+void window_context::finish_setup() {
+    if (this->wm_delete != None) {
+        return;
     }
 
-    if (i < MAX_CHILDREN) {
-        // The entry with len = 0 marks the end
-        this->children[i].len = 0;
+    const unsigned long long start = perf_now_ns();
+
+    // Ask the window manager to tell us when the window is closed instead of
+    // killing the connection, which a resident fx has to keep
+    this->wm_delete = XInternAtom(this->dis, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(this->dis, this->win, &this->wm_delete, 1);
+    this->startup.deferred_round_trips++;
+
+    // Have Xlib fetch its copy of the keymap now instead of on the first key press
+    XKeyEvent probe;
+    int min_keycode;
+    int max_keycode;
+
+    memset(&probe, 0, sizeof(probe));
+    XDisplayKeycodes(this->dis, &min_keycode, &max_keycode);
+    probe.type = KeyPress;
+    probe.display = this->dis;
+    probe.window = this->win;
+    probe.keycode = min_keycode;
+    XLookupKeysym(&probe, 0);
+    this->startup.deferred_round_trips++;
+
+    // Shared memory for the client side canvas
+    this->startup.deferred_round_trips += this->back_buffer->finish_setup();
+
+    this->startup.deferred_ns = perf_now_ns() - start;
+}
+
+int window_context::format_startup(char * const buf, size_t buf_size) const {
+    char first_frame[16];
+    char deferred[16];
+
+    if (this->startup.first_frame_ns == 0) {
+        return snprintf(buf, buf_size, "%-8s waiting for the first frame", "startup");
     }
 
-    quicksort(this->children, 0, i - 1);
+    format_ns(first_frame, sizeof(first_frame), this->startup.first_frame_ns);
+    format_ns(deferred, sizeof(deferred), this->startup.deferred_ns);
+
+    return snprintf(
+        buf, buf_size, "%-8s %s to frame, %u round trips (+%u in %s)", "startup",
+        first_frame, this->startup.round_trips, this->startup.deferred_round_trips, deferred
+    );
+}
+
+void window_context::dump_perf(FILE * out) {
+    const perf_stats &perf = this->model.get_perf();
+    const uint64_t frames = this->frame_times.count();
+    char load[16];
+
+    format_ns(load, sizeof(load), perf.load_ns);
+
+    char startup[128];
+    char connect[16];
+
+    this->format_startup(startup, sizeof(startup));
+    format_ns(connect, sizeof(connect), this->startup.connect_ns);
+
+    fprintf(out, "fx timings\n");
+    fprintf(out, "%s, connect %s\n", startup, connect);
+    this->frame_times.dump(out, "frame");
+    fprintf(
+        out, "X reqs   %llu in %llu frames, %.1f per frame\n",
+        this->total_frame_requests, (unsigned long long) frames, frames == 0 ? 0.0 : (double) this->total_frame_requests / frames
+    );
+    fprintf(out, "Last navigation: %s (load %s)\n", this->model.cwd(), perf.load_ns != 0 ? load : "not finished");
+    perf.readdir.dump(out, "readdir");
+    perf.stat.dump(out, "stat");
+    perf.sort.dump(out, "sort");
+    fprintf(out, "listing  %zu entries, %zu KiB\n", this->model.listing().size(), this->model.listing().memory_usage() / 1024);
+
+    const dir_prefetcher &prefetcher = this->model.get_prefetcher();
+
+    fprintf(out, "prefetch %lu hits, %lu wasted, %lu abandoned\n", prefetcher.hits, prefetcher.wasted, prefetcher.abandoned);
+
+    const listing_snapshots &snapshots = this->model.get_snapshots();
+
+    fprintf(out, "snapshot %lu loaded, %lu rejected, %lu saved\n", snapshots.loaded, snapshots.rejected, snapshots.saved.load());
 }
 
 void window_context::draw_help() {
-    XSetForeground(this->dis, this->gc, this->black);
-    XFillRectangle(this->dis, this->back_buffer, this->gc, 0, 0, this->window_attrs.width, this->window_attrs.height);
-    XSetForeground(this->dis, this->gc, this->text_color);
+    this->back_buffer->set_color(this->black);
+    this->back_buffer->fill_rect(0, 0, this->win_width, this->win_height);
+    this->back_buffer->set_color(this->text_color);
 
     const char about[] =
 R"(
@@ -380,7 +963,10 @@ R"(
 
     Press
     'h' to show this help screen,
-    'c' to close fx and cd to the chosen directory, and
+    'c' to close fx and cd to the chosen directory,
+    '/' to filter the list by name (Escape clears it),
+    'f' to find files anywhere below this directory,
+    Left or Backspace to go back, Right to go forward, and
     'q' to quit.
 
 
@@ -396,88 +982,286 @@ R"(
     Press any key to close this help screen.
 )";
     this->print_multiline_str(about, 0, 40);
-    XCopyArea(this->dis, this->back_buffer, this->win, this->gc, 0, 0, this->window_attrs.width, this->window_attrs.height, 0, 0);
+    this->back_buffer->present(0, 0, this->win_width, this->win_height);
+}
+
+void window_context::request_visible_stats() {
+    size_t size = this->model.num_shown();
+    size_t screen_rows = this->view.capacity();
+    size_t first = this->view.first() < size ? this->view.first() : size;
+    size_t last = first + screen_rows < size ? first + screen_rows : size;
+
+    this->model.request_shown_stats(first, last);
+    this->model.request_shown_stats(last, last + screen_rows < size ? last + screen_rows : size);
+    this->model.request_shown_stats(first > screen_rows ? first - screen_rows : 0, first);
 }
 
 void window_context::redraw() {
+    this->update_layout();
+    this->request_visible_stats();
+    this->hover_row = this->view.screen_row_at(this->mouse_y);
+    this->needs_redraw = false;
+    this->damage(0, this->win_height);
+    this->repaint();
+}
+
+void window_context::update_layout() {
+    this->model.update_filter();
+    this->view.resize(this->model.num_shown(), this->win_height - LIST_TOP - STATUS_HEIGHT);
+}
+
+void window_context::scroll_by(int delta) {
     if (this->show_help) {
-        this->draw_help();
         return;
     }
 
-    XSetForeground(this->dis, this->gc, this->black);
-    XFillRectangle(this->dis, this->back_buffer, this->gc, 0, 0, this->window_attrs.width, this->window_attrs.height);
-    XSetForeground(this->dis, this->gc, this->text_color);
-    XDrawString(this->dis, this->back_buffer, this->gc, 0, 10, this->cwd, this->cwd_len);
+    this->update_layout();
+
+    delta = this->view.scroll_by(delta);
+
+    if (delta == 0) {
+        return;
+    }
 
-    int y = 23;
+    const int fit = this->view.capacity();
 
-    int i;
-    for (i = this->scrollrow; i < MAX_CHILDREN; i++) {
-        path_segment &path = this->children[i];
+    if (this->needs_redraw || delta >= fit || -delta >= fit) {
+        // Everything is drawn from scratch anyway, or none of the rows on screen are
+        // still visible
+        this->needs_redraw = true;
+
+        return;
+    }
+
+    // Anything that's out of date has to be drawn before it's moved
+    this->repaint();
+
+    const int width = this->win_width;
+    const int shift = (delta > 0 ? delta : -delta) * ROW_HEIGHT;
+    const int kept = fit * ROW_HEIGHT - shift;
+
+    if (delta > 0) {
+        this->back_buffer->copy_rows(LIST_TOP + shift, LIST_TOP, width, kept);
+    } else {
+        this->back_buffer->copy_rows(LIST_TOP, LIST_TOP + shift, width, kept);
+    }
+
+    this->request_visible_stats();
+    this->update_layout();
+
+    // The rows that came into view
+    if (delta > 0) {
+        this->damage(LIST_TOP + kept, LIST_TOP + fit * ROW_HEIGHT);
+    } else {
+        this->damage(LIST_TOP, LIST_TOP + shift);
+    }
 
-        if (path.len == 0 || y > (this->window_attrs.height - 10)) {
-            break;
+    // The rows at either end and on either side of the seam were moved along with
+    // text that spilled into them from rows that are no longer next to them
+    this->damage_row(0);
+    this->damage(LIST_TOP + kept + shift - ROW_HEIGHT, LIST_TOP + kept + shift + TEXT_DESCENT);
+    this->damage_row(delta > 0 ? fit - delta - 1 : -delta);
+
+    // The hover highlight was moved with its row, but it belongs under the pointer
+    if (this->hover_row != -1) {
+        this->damage_row(this->hover_row - delta);
+    }
+
+    this->hover_row = this->view.screen_row_at(this->mouse_y);
+    this->damage_row(this->hover_row);
+    this->damage_status();
+
+    // The timings box was moved too. It's drawn again after the frame, but the rows
+    // it was moved into need to be cleaned up.
+    if (this->debug_enabled) {
+        const int overlay_top = LIST_TOP + TEXT_DESCENT;
+
+        this->damage(overlay_top - shift, overlay_top + PERF_OVERLAY_LINES * ROW_HEIGHT + TEXT_DESCENT + shift);
+    }
+
+    for (size_t i = 0; i < this->num_damage; i++) {
+        this->paint(this->damage_top[i], this->damage_bottom[i]);
+    }
+
+    this->num_damage = 0;
+
+    // Everything below the current directory moved, so it goes to the window in one copy
+    this->back_buffer->present(0, LIST_TOP, width, this->win_height - LIST_TOP);
+}
+
+void window_context::damage(int top, int bottom) {
+    if (top < 0) {
+        top = 0;
+    }
+
+    if (bottom > this->win_height) {
+        bottom = this->win_height;
+    }
+
+    if (top >= bottom) {
+        return;
+    }
+
+    for (size_t i = 0; i < this->num_damage; i++) {
+        if (top <= this->damage_bottom[i] && bottom >= this->damage_top[i]) {
+            // Touches a band that's already out of date, so grow that one
+            this->damage_top[i] = top < this->damage_top[i] ? top : this->damage_top[i];
+            this->damage_bottom[i] = bottom > this->damage_bottom[i] ? bottom : this->damage_bottom[i];
+
+            return;
         }
+    }
 
-        const bool has_perm = this->has_permission(path);
-        const bool is_selected = this->mouse_y < y && this->mouse_y >= (y - ROW_HEIGHT);
+    if (this->num_damage == MAX_DAMAGE) {
+        this->num_damage = 1;
+        this->damage_top[0] = 0;
+        this->damage_bottom[0] = this->win_height;
+
+        return;
+    }
 
-        if (! has_perm) {
-            XSetForeground(this->dis, this->gc, this->no_perm_color);
-            XFillRectangle(this->dis, this->back_buffer, this->gc, 0, y - ROW_HEIGHT, this->window_attrs.width, ROW_HEIGHT);
+    this->damage_top[this->num_damage] = top;
+    this->damage_bottom[this->num_damage] = bottom;
+    this->num_damage++;
+}
+
+void window_context::damage_row(int screen_row) {
+    if (screen_row < 0) {
+        return;
+    }
+
+    const int top = this->view.row_top(screen_row);
+
+    this->damage(top, top + ROW_HEIGHT);
+}
+
+void window_context::damage_status() {
+    // The status text is as tall as a row and reaches above the line
+    this->damage(this->win_height - ROW_HEIGHT, this->win_height);
+}
+
+void window_context::repaint() {
+    if (this->num_damage == 0) {
+        return;
+    }
+
+    if (this->show_help) {
+        this->draw_help();
+        this->num_damage = 0;
+
+        return;
+    }
+
+    for (size_t i = 0; i < this->num_damage; i++) {
+        this->paint(this->damage_top[i], this->damage_bottom[i]);
+    }
+
+    for (size_t i = 0; i < this->num_damage; i++) {
+        const int top = this->damage_top[i];
+        const int height = this->damage_bottom[i] - top;
+
+        this->back_buffer->present(0, top, this->win_width, height);
+    }
+
+    this->num_damage = 0;
+}
+
+void window_context::paint(int top, int bottom) {
+    const int width = this->win_width;
+    const int height = this->win_height;
+    const bool clipped = top > 0 || bottom < height;
+
+    if (clipped) {
+        this->back_buffer->set_clip(top, bottom);
+    }
+
+    this->back_buffer->set_color(this->black);
+    this->back_buffer->fill_rect(0, top, width, bottom - top);
+    this->back_buffer->set_color(this->text_color);
+
+    if (top < LIST_TOP + TEXT_DESCENT) {
+        this->back_buffer->draw_string(0, LIST_TOP, this->model.cwd(), this->model.cwd_len());
+    }
+
+    const bool show_sizes = ! this->model.is_searching();
+    dir_listing &listing = this->model.shown_listing();
+
+    // Every row that reaches into the band, including the text that spills out of it
+    int first = (top - LIST_TOP - TEXT_DESCENT) / (int) ROW_HEIGHT - 1;
+    int last = (bottom - LIST_TOP) / (int) ROW_HEIGHT + 1;
+
+    if (first < 0) {
+        first = 0;
+    }
+
+    if (last > this->view.visible_rows()) {
+        last = this->view.visible_rows();
+    }
+
+    // Backgrounds go first so that they don't cover the descenders of the row above
+    for (int k = first; k < last; k++) {
+        const uint8_t flags = listing.flags_at(this->model.shown_row(this->view.first() + k));
+        const int y = this->view.baseline(k);
+        const bool is_selected = k == this->hover_row;
+
+        if (! (flags & ENTRY_PERMITTED)) {
+            this->back_buffer->set_color(this->no_perm_color);
+            this->back_buffer->fill_rect(0, y - ROW_HEIGHT, width, ROW_HEIGHT);
         }
 
         if (is_selected) {
-            XSetForeground(this->dis, this->gc, this->hover_color);
-            XFillRectangle(this->dis, this->back_buffer, this->gc, 0, y - ROW_HEIGHT, this->window_attrs.width, ROW_HEIGHT);
+            this->back_buffer->set_color(this->hover_color);
+            this->back_buffer->fill_rect(0, y - ROW_HEIGHT, width, ROW_HEIGHT);
         }
+    }
 
-        if (! has_perm || is_selected) {
-            XSetForeground(this->dis, this->gc, this->text_color);
-        }
+    this->back_buffer->set_color(this->text_color);
 
-        XDrawString(this->dis, this->back_buffer, this->gc, 20, y, path.name, path.len);
+    for (int k = first; k < last; k++) {
+        const size_t row = this->model.shown_row(this->view.first() + k);
+        const path_segment &path = listing.at(row);
+        const int y = this->view.baseline(k);
 
-        path.y_bot = y;
+        this->back_buffer->draw_string(20, y, listing.name(path), path.len);
 
         if (this->debug_enabled) {
-            unsigned int w = this->window_attrs.width;
+            unsigned int w = width;
             unsigned int h = ROW_HEIGHT;
 
-            XSetForeground(this->dis, this->gc, this->debug_color);
-            XDrawRectangle(this->dis, this->back_buffer, this->gc, 0, path.y_bot - ROW_HEIGHT, w, h);
-            XSetForeground(this->dis, this->gc, this->text_color);
+            this->back_buffer->set_color(this->debug_color);
+            this->back_buffer->draw_rect(0, y - ROW_HEIGHT, w, h);
+            this->back_buffer->set_color(this->text_color);
         }
 
-        this->draw_filetype(y, path.mode);
+        this->draw_filetype(y, listing.flags_at(row));
 
-        y += ROW_HEIGHT;
+        if (show_sizes) {
+            this->draw_size(y, listing.index_at(row));
+        }
     }
 
-    this->max_y = y;
-
-    int screen_rows = (this->window_attrs.height - 20) / ROW_HEIGHT;
-    this->can_scroll = i >= screen_rows;
-    this->max_scrollrow = i - screen_rows + 2;
-
     // Draw the statusline
-    XDrawLine(this->dis, this->back_buffer, this->gc, 0, (this->window_attrs.height - 10), this->window_attrs.width, (this->window_attrs.height - 10));
+    if (bottom > height - (int) ROW_HEIGHT) {
+        this->back_buffer->draw_hline(0, width, height - STATUS_HEIGHT);
 
-    if (this->status_len != 0) {
-        XSetForeground(this->dis, this->gc, this->status_color);
-        XDrawString(this->dis, this->back_buffer, this->gc, 0, this->window_attrs.height, this->status, this->status_len);
+        if (this->status_len != 0) {
+            this->back_buffer->set_color(this->status_color);
+            this->back_buffer->draw_string(0, height, this->status, this->status_len);
+        }
+
+        this->back_buffer->set_color(this->text_color);
     }
 
-    XSetForeground(this->dis, this->gc, this->text_color);
-    XCopyArea(this->dis, this->back_buffer, this->win, this->gc, 0, 0, this->window_attrs.width, this->window_attrs.height, 0, 0);
+    if (clipped) {
+        this->back_buffer->clear_clip();
+    }
 }
 
-void window_context::draw_filetype(int y, unsigned int mode) {
+void window_context::draw_filetype(int y, uint8_t flags) {
     const char * type_str;
     unsigned long type_color;
 
-    if (S_ISDIR(mode)) {
+    if (flags & ENTRY_DIR) {
         type_str = "d";
         type_color = this->dir_color;
     } else {
@@ -485,81 +1269,127 @@ void window_context::draw_filetype(int y, unsigned int mode) {
         type_color = this->file_color;
     }
 
-    XSetForeground(this->dis, this->gc, type_color);
-    XDrawString(this->dis, this->back_buffer, this->gc, 5, y, type_str, 1);
-    XSetForeground(this->dis, this->gc, this->text_color);
+    this->back_buffer->set_color(type_color);
+    this->back_buffer->draw_string(5, y, type_str, 1);
+    this->back_buffer->set_color(this->text_color);
 }
 
-path_segment * window_context::get_selected_segment() {
-    if (this->mouse_y > this->max_y || this->mouse_y < 10) {
-        return nullptr;
+// Formats `bytes` in at most 5 characters, like `du -h`
+static int format_size(char * const buf, size_t buf_size, uint64_t bytes) {
+    const char units[] = "BKMGTPE";
+    double value = bytes;
+    size_t unit = 0;
+
+    while (value >= 1024 && unit < sizeof(units) - 2) {
+        value /= 1024;
+        unit++;
     }
 
-    int curr_row = (this->mouse_y - 10) / ROW_HEIGHT;
+    if (unit == 0) {
+        return snprintf(buf, buf_size, "%lluB", (unsigned long long) bytes);
+    } else if (value < 10) {
+        return snprintf(buf, buf_size, "%.1f%c", value, units[unit]);
+    }
 
-    return &this->children[curr_row];
+    return snprintf(buf, buf_size, "%.0f%c", value, units[unit]);
 }
 
-void window_context::path_join(char * const wd, size_t * wd_len, path_segment &path) {
-    if (path.len == 1 && path.name[0] == '.') {
-        // Do nothing
+void window_context::draw_size(int y, uint32_t index) {
+    const dir_size * size = this->model.size_of(index);
+
+    if (! size) {
         return;
-    } else if (*wd_len == 1 && wd[0] == '/') {
-        if (path.len == 2 && path.name[0] == '.' && path.name[1] == '.') {
-            // Can't go up from root
-            return;
-        }
+    }
 
-        // Root - just append the next thing
-        memcpy(wd + 1, path.name, path.len);
-        *wd_len = path.len + 1;
-        wd[path.len + 1] = '\0';
-    } else if (path.len == 2 && path.name[0] == '.' && path.name[1] == '.') {
-        // Strip out last part of path
-        int slashpos = *wd_len;
+    char buf[16];
+    int len = format_size(buf, sizeof(buf), size->bytes);
 
-        while (slashpos && (wd[--slashpos] != '/'));
+    if (size->state == SIZE_PARTIAL) {
+        // Still counting; the total is at least this much
+        buf[len++] = '+';
+        this->back_buffer->set_color(this->file_color);
+    }
 
-        if (slashpos == 0) {
-            // Last slash is root, so leave it in
-            wd[1] = '\0';
-            *wd_len = 1;
-        } else {
-            *wd_len = slashpos;
-            wd[slashpos] = '\0';
-        }
-    } else {
-        wd[*wd_len] = '/';
-        memcpy(wd + *wd_len + 1, path.name, path.len);
-        *wd_len += path.len + 1;
-        wd[*wd_len] = '\0';
+    this->back_buffer->draw_string(this->win_width - SIZE_COLUMN_WIDTH, y, buf, len);
+    this->back_buffer->set_color(this->text_color);
+}
+
+bool window_context::get_selected_row(size_t * row) {
+    size_t entry;
+
+    if (! this->view.entry_at(this->mouse_y, &entry) || entry >= this->model.num_shown()) {
+        return false;
     }
+
+    *row = this->model.shown_row(entry);
+
+    return true;
 }
 
-void window_context::navigate(path_segment &path) {
-    this->path_join(this->cwd, &this->cwd_len, path);
+void window_context::navigate(const char * const name, size_t len) {
+    char old_cwd[PATH_MAX + 1];
+    const size_t old_top = this->top_row();
+
+    memcpy(old_cwd, this->model.cwd(), this->model.cwd_len() + 1);
+    this->model.navigate(name, len);
 
-    if (this->dir) {
-        int retval = closedir(this->dir);
-        check_error(retval, -1);
+    // "." and ".." at the root go nowhere, so there's nothing to come back to
+    if (strcmp(old_cwd, this->model.cwd()) != 0) {
+        this->history.push(old_cwd, old_top);
     }
 
-    this->dir = opendir(this->cwd);
-    check_error(this->dir, (DIR *) NULL);
+    this->navigated(this->history.position_of(this->model.cwd()));
+}
+
+void window_context::go_back(bool forward) {
+    const history_entry * entry = forward ? this->history.forward(this->model.cwd(), this->top_row()) : this->history.back(this->model.cwd(), this->top_row());
+
+    if (! entry) {
+        this->set_status(forward ? "Nothing to go forward to" : "Nothing to go back to");
+        return;
+    }
+
+    this->model.open(entry->path);
+    this->navigated(entry->top);
+}
+
+size_t window_context::top_row() const {
+    if (this->model.is_searching() || this->model.num_shown() == 0) {
+        return 0;
+    }
 
-    this->read_child_dirs(0);
-    this->scrollrow = 0;
+    return this->model.shown_row(this->view.first());
 }
 
-bool window_context::has_permission(path_segment &path) {
-    if (S_ISDIR(path.mode)) {
-        return (S_IXOTH & path.mode) || ((S_IXUSR & path.mode) && this->uid == path.uid) || ((S_IXGRP & path.mode) && this->gid == path.gid);
+void window_context::navigated(size_t top) {
+    this->clear_filter();
+    this->update_layout();
+    this->view.scroll_to(top);
+    // If the listing isn't all there yet, try again once it is
+    this->pending_top = this->model.is_load_done() ? 0 : top;
+    this->needs_redraw = true;
+    this->track_dwell(true);
+
+    if (this->debug_enabled) {
+        this->show_cache_stats();
     }
+}
 
-    return (S_IROTH & path.mode) || ((S_IRUSR & path.mode) && this->uid == path.uid) || ((S_IRGRP & path.mode) && this->gid == path.gid);
+void window_context::show_cache_stats() {
+    const dir_cache &cache = this->model.get_cache();
+    const dir_prefetcher &prefetcher = this->model.get_prefetcher();
+    char msg[c_arr_size(this->status)];
+
+    snprintf(
+        msg, sizeof(msg), "Cache: %lu hits, %lu misses, %lu invalidated, %zu dirs, %zu KiB; prefetch: %lu hits, %lu wasted, %lu abandoned",
+        cache.hits, cache.misses, cache.invalidations, cache.size(), cache.memory_usage() / 1024,
+        prefetcher.hits, prefetcher.wasted, prefetcher.abandoned
+    );
+    this->set_status(msg);
 }
 
 void window_context::set_status(const char * const text) {
     this->status_len = strlen(text);
     memcpy(this->status, text, this->status_len + 1);
+    this->damage_status();
 }